@@ -8,19 +8,46 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+static int sbuf_size = 0;
+static int sbuf_wpos = 0;
+
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
+// the count written is relative to the last one read
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *buf = ctl->buf.start;
+  int len = (uint8_t *)ctl->buf.end - buf;
+  while (len > 0) {
+    int count = inl(AUDIO_COUNT_ADDR);
+    int n = sbuf_size - count;
+    if (n == 0) continue;
+    if (n > len) n = len;
+    uint8_t *sbuf = (uint8_t *)AUDIO_SBUF_ADDR;
+    int i;
+    for (i = 0; i < n; i ++) {
+      sbuf[sbuf_wpos] = buf[i];
+      sbuf_wpos = (sbuf_wpos + 1) % sbuf_size;
+    }
+    outl(AUDIO_COUNT_ADDR, count + n);
+    buf += n;
+    len -= n;
+  }
 }
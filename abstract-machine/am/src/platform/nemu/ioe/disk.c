@@ -1,12 +1,35 @@
 #include <am.h>
 #include <nemu.h>
 
+#define DISK_BLKSZ_ADDR  (DISK_ADDR + 0x00)
+#define DISK_BLKCNT_ADDR (DISK_ADDR + 0x04)
+#define DISK_BUF_ADDR    (DISK_ADDR + 0x08)
+#define DISK_BLKNO_ADDR  (DISK_ADDR + 0x0c)
+#define DISK_COUNT_ADDR  (DISK_ADDR + 0x10)
+#define DISK_CMD_ADDR    (DISK_ADDR + 0x14)
+#define DISK_STATUS_ADDR (DISK_ADDR + 0x18)
+
+#define DISK_READ  1
+#define DISK_WRITE 2
+#define DISK_BUSY  0x1
+
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->blksz = inl(DISK_BLKSZ_ADDR);
+  cfg->blkcnt = inl(DISK_BLKCNT_ADDR);
+  cfg->present = (cfg->blkcnt > 0);
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
+  stat->ready = !(inl(DISK_STATUS_ADDR) & DISK_BUSY);
 }
 
+// the blocks are copied by the device, wait until it is done
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  while (inl(DISK_STATUS_ADDR) & DISK_BUSY);
+  outl(DISK_BUF_ADDR, (uintptr_t)io->buf);
+  outl(DISK_BLKNO_ADDR, io->blkno);
+  outl(DISK_COUNT_ADDR, io->blkcnt);
+  outl(DISK_CMD_ADDR, io->write ? DISK_WRITE : DISK_READ);
+  while (inl(DISK_STATUS_ADDR) & DISK_BUSY);
+  outl(DISK_STATUS_ADDR, 0);
 }
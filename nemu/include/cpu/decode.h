@@ -17,6 +17,7 @@
 #define __CPU_DECODE_H__
 
 #include <isa.h>
+#include <difftest-def.h>
 
 typedef struct Decode {
   vaddr_t pc;
@@ -24,6 +25,7 @@ typedef struct Decode {
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
   IFDEF(CONFIG_ITRACE, char logbuf[128]);
+  IFDEF(CONFIG_COMMIT_LOG, DifftestCommit commit);
 } Decode;
 
 // --- pattern matching mechanism ---
@@ -19,26 +19,51 @@
 #include <common.h>
 #include <difftest-def.h>
 
+struct Decode;
+
 #ifdef CONFIG_DIFFTEST
 void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
-void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_step(struct Decode *s, vaddr_t npc);
+void difftest_sync();
+void difftest_device(paddr_t addr, int len, word_t data, bool is_write);
 void difftest_detach();
 void difftest_attach();
+void difftest_start_at(uint64_t n);
+void difftest_dma_begin();
+void difftest_dma(paddr_t addr, size_t n);
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
-static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_step(struct Decode *s, vaddr_t npc) {}
+static inline void difftest_sync() {}
+static inline void difftest_device(paddr_t addr, int len, word_t data, bool is_write) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
+static inline void difftest_start_at(uint64_t n) {}
+static inline void difftest_dma_begin() {}
+static inline void difftest_dma(paddr_t addr, size_t n) {}
+#endif
+
+// called on each store to pmem
+#if defined(CONFIG_DIFFTEST_BATCH) || defined(CONFIG_DIFFTEST_MEMHASH)
+void difftest_store(paddr_t addr, int len, word_t data);
+#else
+static inline void difftest_store(paddr_t addr, int len, word_t data) {}
 #endif
 
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern void (*ref_difftest_commit)(DifftestCommit *c);
+extern uint64_t (*ref_difftest_memhash)(paddr_t addr, size_t n);
+extern void (*ref_difftest_exec_until)(uint64_t n, uint64_t pc, uint64_t nr_hit);
+extern void (*ref_difftest_csrcpy)(void *csr, bool direction);
+extern bool (*ref_difftest_mmio)(DifftestMMIO *ev, int n);
+extern size_t (*ref_difftest_dirty_pages)(paddr_t *page, size_t max);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
@@ -16,9 +16,12 @@
 #ifndef __CPU_IFETCH_H__
 
 #include <memory/vaddr.h>
+#include <cpu/perf.h>
 
 static inline uint32_t inst_fetch(vaddr_t *pc, int len) {
+  int perf = perf_enter(PERF_FETCH);
   uint32_t inst = vaddr_ifetch(*pc, len);
+  perf_leave(perf);
   (*pc) += len;
   return inst;
 }
@@ -0,0 +1,31 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_IRINGBUF_H__
+#define __CPU_IRINGBUF_H__
+
+#include <common.h>
+
+struct Decode;
+
+#ifdef CONFIG_IRINGBUF
+void iringbuf_record(struct Decode *s);
+void iringbuf_display();
+#else
+static inline void iringbuf_record(struct Decode *s) {}
+static inline void iringbuf_display() {}
+#endif
+
+#endif
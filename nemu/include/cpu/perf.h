@@ -0,0 +1,89 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_PERF_H__
+#define __CPU_PERF_H__
+
+#include <common.h>
+
+enum {
+  PERF_LOOP,     // the rest of the emulator loop
+  PERF_FETCH,    // instruction fetch
+  PERF_EXEC,     // decode and execute
+  PERF_MEM,      // memory access by loads and stores
+  PERF_MMIO,     // device map lookup and callbacks
+  PERF_DEVICE,   // device_update()
+  PERF_TRACE,    // itrace and watchpoints
+  PERF_DIFFTEST, // differential testing
+  NR_PERF
+};
+
+#ifdef CONFIG_PERF
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t perf_clock() { return __rdtsc(); }
+#else
+#include <time.h>
+static inline uint64_t perf_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+#endif
+
+#define PERF_SAMPLE_MASK BITMASK(CONFIG_PERF_SAMPLE_SHIFT)
+
+extern bool perf_sampling;
+extern int perf_phase;
+extern uint64_t perf_last;
+extern uint64_t perf_cycles[NR_PERF];
+
+void perf_sample_begin();
+void perf_sample_end();
+void perf_display();
+
+// Charge the time since the last switch to the current phase, then switch to
+// `phase'. The previous phase is returned and should be restored by perf_leave().
+static inline int perf_enter(int phase) {
+  if (likely(!perf_sampling)) return phase;
+  uint64_t now = perf_clock();
+  perf_cycles[perf_phase] += now - perf_last;
+  perf_last = now;
+  int old = perf_phase;
+  perf_phase = phase;
+  return old;
+}
+
+static inline void perf_leave(int old) { perf_enter(old); }
+
+// memory accesses issued by instruction fetch are charged to the fetch phase
+static inline int perf_enter_mem() {
+  return perf_enter(perf_phase == PERF_FETCH ? PERF_FETCH : PERF_MEM);
+}
+
+// called once per instruction to decide whether it is profiled
+static inline void perf_sample(uint64_t nr_inst) {
+  if (unlikely(perf_sampling)) perf_sample_end();
+  if (unlikely((nr_inst & PERF_SAMPLE_MASK) == 0)) perf_sample_begin();
+}
+#else
+static inline int perf_enter(int phase) { return phase; }
+static inline void perf_leave(int old) {}
+static inline int perf_enter_mem() { return 0; }
+static inline void perf_sample(uint64_t nr_inst) {}
+static inline void perf_sample_end() {}
+#endif
+
+#endif
@@ -29,9 +29,10 @@
     if (!(cond)) { \
       MUXDEF(CONFIG_TARGET_AM, printf(ANSI_FMT(format, ANSI_FG_RED) "\n", ## __VA_ARGS__), \
         (fflush(stdout), fprintf(stderr, ANSI_FMT(format, ANSI_FG_RED) "\n", ##  __VA_ARGS__))); \
-      IFNDEF(CONFIG_TARGET_AM, extern FILE* log_fp; fflush(log_fp)); \
+      IFNDEF(CONFIG_TARGET_AM, log_flush()); \
       extern void assert_fail_msg(); \
       assert_fail_msg(); \
+      IFNDEF(CONFIG_TARGET_AM, log_flush()); \
       assert(cond); \
     } \
   } while (0)
@@ -0,0 +1,33 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+// Events are due at a guest time in us, see get_guest_time(). They are run
+// by device_update() on the emulator thread, so the handlers can touch the
+// devices and raise interrupts freely.
+typedef void (*event_handler_t)(void *arg);
+
+// Run `h(arg)' after `delay' us, which must be positive, then every `period'
+// us if it is not zero.
+// Return an id for event_cancel().
+int event_add(uint64_t delay, uint64_t period, event_handler_t h, void *arg);
+void event_cancel(int id);
+void event_update();
+
+#endif
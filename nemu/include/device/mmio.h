@@ -21,4 +21,9 @@
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
 
+#define NR_MAP 16
+
+int mmio_map_id(paddr_t addr);
+const char* mmio_map_name(int mapid);
+
 #endif
@@ -17,6 +17,7 @@
 #define __DIFFTEST_DEF_H__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <generated/autoconf.h>
 
 enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
@@ -33,4 +34,56 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupport ISA
 #endif
 
+#if defined(CONFIG_ISA_riscv32) || defined(CONFIG_ISA_riscv64)
+// The CSRs copied in bulk by difftest_csrcpy() as an array of words in
+// this order, given as f(name, address). mip is left out since its
+// pending bits follow the devices of each side.
+#define DIFFTEST_CSR_LIST(f) \
+  f(mstatus, 0x300) f(misa, 0x301) f(medeleg, 0x302) f(mideleg, 0x303) \
+  f(mie, 0x304) f(mtvec, 0x305) f(mscratch, 0x340) f(mepc, 0x341) \
+  f(mcause, 0x342) f(mtval, 0x343) \
+  f(stvec, 0x105) f(sscratch, 0x140) f(sepc, 0x141) f(scause, 0x142) \
+  f(stval, 0x143) f(satp, 0x180)
+
+#define DIFFTEST_CSR_ENUM(name, addr) DIFFTEST_CSR_##name,
+enum { DIFFTEST_CSR_LIST(DIFFTEST_CSR_ENUM) NR_DIFFTEST_CSR };
+#endif
+
+// The architectural effect of one instruction. `wreg' is the index of the
+// written register when the registers are viewed as an array of words in
+// the layout of difftest_regcpy(), and 0 means no register is written.
+typedef struct {
+  uint64_t pc;
+  uint64_t npc;
+  uint64_t wdata;
+  uint64_t maddr;
+  uint64_t mdata;
+  uint32_t wreg;
+  uint32_t mlen; // length of the store, 0 means no store
+} DifftestCommit;
+
+// A device access of the DUT, which is replayed by the REF instead of
+// accessing its own devices, see difftest_mmio().
+typedef struct {
+  uint64_t addr;
+  uint64_t data;
+  uint32_t len;
+  uint32_t is_write;
+} DifftestMMIO;
+
+// The hash of memory used by difftest_memhash(). Both sides must compute it
+// in the same way, so it is defined here. Hashing a range in several pieces
+// gives the same result as long as each piece is a multiple of 8 bytes.
+#define DIFFTEST_HASH_INIT 0xcbf29ce484222325ull
+
+static inline uint64_t difftest_hash(uint64_t h, const void *buf, size_t n) {
+  const uint64_t *p = (const uint64_t *)buf;
+  size_t i;
+  for (i = 0; i < n / 8; i ++) {
+    h = (h ^ p[i]) * 0x100000001b3ull;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
 #endif
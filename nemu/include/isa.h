@@ -36,6 +36,8 @@ word_t isa_reg_str2val(const char *name, bool *success);
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+enum { BR_NONE, BR_COND, BR_JUMP, BR_INDIRECT, BR_CALL, BR_RET };
+int isa_branch_type(struct Decode *s);
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
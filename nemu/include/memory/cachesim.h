@@ -0,0 +1,32 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MEMORY_CACHESIM_H__
+#define __MEMORY_CACHESIM_H__
+
+#include <common.h>
+
+enum { CACHE_I, CACHE_D };
+
+#ifdef CONFIG_CACHESIM
+void init_cachesim();
+void cachesim_access(int type, paddr_t addr, int len, bool is_write);
+void cachesim_display();
+#else
+static inline void init_cachesim() {}
+static inline void cachesim_access(int type, paddr_t addr, int len, bool is_write) {}
+#endif
+
+#endif
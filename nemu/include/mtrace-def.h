@@ -0,0 +1,45 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __MTRACE_DEF_H__
+#define __MTRACE_DEF_H__
+
+#include <stdint.h>
+
+// The mtrace file is a header followed by a ring of `capacity' records.
+// Record `i' is stored at slot `i % capacity', and `count' records have
+// been written in total.
+
+#define MTRACE_MAGIC 0x4543524d // "MRCE"
+
+enum { MTRACE_READ, MTRACE_WRITE };
+
+typedef struct {
+  uint32_t magic;
+  uint32_t record_size;
+  uint64_t capacity;
+  uint64_t count;
+  uint64_t reserved;
+} MTraceHeader;
+
+typedef struct {
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t data;
+  uint32_t len;
+  uint32_t type;
+} MTraceRecord;
+
+#endif
@@ -33,6 +33,8 @@ extern NEMUState nemu_state;
 // ----------- timer -----------
 
 uint64_t get_time();
+// the time seen by the guest, only depends on the instructions in icount mode
+uint64_t get_guest_time();
 
 // ----------- log -----------
 
@@ -56,6 +58,16 @@ uint64_t get_time();
 
 #define ANSI_FMT(str, fmt) fmt str ANSI_NONE
 
+#ifdef CONFIG_LOG_ASYNC
+#define log_write(...) \
+  do { \
+    extern bool log_enable(); \
+    extern void log_async_write(const char *fmt, ...); \
+    if (log_enable()) { \
+      log_async_write(__VA_ARGS__); \
+    } \
+  } while (0)
+#else
 #define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
   do { \
     extern FILE* log_fp; \
@@ -66,6 +78,28 @@ uint64_t get_time();
     } \
   } while (0) \
 )
+#endif
+
+void log_flush();
+
+// ----------- mtrace -----------
+
+#ifdef CONFIG_MTRACE
+extern paddr_t mtrace_low, mtrace_high;
+void init_mtrace();
+void mtrace_record(vaddr_t pc, paddr_t addr, int len, word_t data, bool is_write);
+bool mtrace_add_range(paddr_t low, paddr_t high);
+void mtrace_clear_range();
+void mtrace_list_range();
+
+static inline void mtrace_access(vaddr_t pc, paddr_t addr, int len, word_t data, bool is_write) {
+  if (likely(addr < mtrace_low || addr > mtrace_high)) return;
+  mtrace_record(pc, addr, len, data, is_write);
+}
+#else
+static inline void init_mtrace() {}
+static inline void mtrace_access(vaddr_t pc, paddr_t addr, int len, word_t data, bool is_write) {}
+#endif
 
 #define _Log(...) \
   do { \
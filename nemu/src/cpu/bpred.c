@@ -0,0 +1,227 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/bpred.h>
+
+#ifdef CONFIG_BPRED
+
+extern uint64_t g_nr_guest_inst;
+
+enum { PRED_SKIP, PRED_HIT, PRED_MISS };
+
+// instructions are aligned to 4 bytes except on x86
+#define PC_INDEX(pc) ((pc) >> MUXDEF(CONFIG_ISA_x86, 0, 2))
+
+#define TABLE_SIZE (1u << CONFIG_BPRED_TABLE_SHIFT)
+#define TABLE_MASK (TABLE_SIZE - 1)
+
+// global history of the outcomes of conditional branches, the latest in bit 0
+static uint64_t ghist = 0;
+
+static inline void counter_update(uint8_t *c, bool taken) {
+  if (taken) { if (*c < 3) (*c) ++; }
+  else { if (*c > 0) (*c) --; }
+}
+
+static inline int direction_result(bool pred, bool taken) {
+  return (pred == taken ? PRED_HIT : PRED_MISS);
+}
+
+/* bimodal */
+#ifdef CONFIG_BPRED_BIMODAL
+static uint8_t bimodal_ctr[TABLE_SIZE];
+
+static int bimodal_step(Decode *s, int type) {
+  if (type != BR_COND) return PRED_SKIP;
+  bool taken = (s->dnpc != s->snpc);
+  uint8_t *c = &bimodal_ctr[PC_INDEX(s->pc) & TABLE_MASK];
+  bool pred = (*c >= 2);
+  counter_update(c, taken);
+  return direction_result(pred, taken);
+}
+#endif
+
+/* gshare */
+#ifdef CONFIG_BPRED_GSHARE
+static uint8_t gshare_ctr[TABLE_SIZE];
+
+static int gshare_step(Decode *s, int type) {
+  if (type != BR_COND) return PRED_SKIP;
+  bool taken = (s->dnpc != s->snpc);
+  uint8_t *c = &gshare_ctr[(PC_INDEX(s->pc) ^ ghist) & TABLE_MASK];
+  bool pred = (*c >= 2);
+  counter_update(c, taken);
+  return direction_result(pred, taken);
+}
+#endif
+
+/* TAGE-lite: a bimodal base predictor and tagged tables indexed with
+ * geometrically increasing history lengths. The longest matching table
+ * provides the prediction, and a misprediction allocates an entry in a
+ * longer table whose useful counter is zero.
+ */
+#ifdef CONFIG_BPRED_TAGE
+#define TAGE_NR_TABLE 4
+#define TAGE_TAG_BITS 9
+
+typedef struct {
+  uint16_t tag;
+  int8_t ctr;   // [-4, 3], taken if >= 0
+  uint8_t u;    // [0, 3]
+} TageEntry;
+
+static const int tage_hist_len[TAGE_NR_TABLE] = { 5, 12, 27, 60 };
+static TageEntry tage_table[TAGE_NR_TABLE][TABLE_SIZE];
+static uint8_t tage_base[TABLE_SIZE];
+
+static uint32_t fold(uint64_t h, int len, int bits) {
+  h &= BITMASK(len);
+  uint32_t ret = 0;
+  for (; h != 0; h >>= bits) ret ^= h & BITMASK(bits);
+  return ret;
+}
+
+static int tage_step(Decode *s, int type) {
+  if (type != BR_COND) return PRED_SKIP;
+  bool taken = (s->dnpc != s->snpc);
+  uint64_t pc = PC_INDEX(s->pc);
+  uint32_t idx[TAGE_NR_TABLE], tag[TAGE_NR_TABLE];
+  int provider = -1, alt = -1;
+  int t;
+  for (t = TAGE_NR_TABLE - 1; t >= 0; t --) {
+    int len = tage_hist_len[t];
+    idx[t] = (pc ^ (pc >> CONFIG_BPRED_TABLE_SHIFT) ^ fold(ghist, len, CONFIG_BPRED_TABLE_SHIFT)) & TABLE_MASK;
+    tag[t] = (pc ^ fold(ghist, len, TAGE_TAG_BITS) ^ (fold(ghist, len, TAGE_TAG_BITS - 1) << 1)) &
+      BITMASK(TAGE_TAG_BITS);
+    if (tage_table[t][idx[t]].tag == tag[t]) {
+      if (provider == -1) provider = t;
+      else if (alt == -1) alt = t;
+    }
+  }
+
+  uint8_t *base = &tage_base[pc & TABLE_MASK];
+  bool base_pred = (*base >= 2);
+  bool alt_pred = (alt == -1 ? base_pred : tage_table[alt][idx[alt]].ctr >= 0);
+  bool pred = base_pred;
+
+  if (provider != -1) {
+    TageEntry *e = &tage_table[provider][idx[provider]];
+    pred = (e->ctr >= 0);
+    if (pred != alt_pred) {
+      if (pred == taken) { if (e->u < 3) e->u ++; }
+      else { if (e->u > 0) e->u --; }
+    }
+    if (taken) { if (e->ctr < 3) e->ctr ++; }
+    else { if (e->ctr > -4) e->ctr --; }
+  } else {
+    counter_update(base, taken);
+  }
+
+  if (pred != taken) {
+    bool allocated = false;
+    for (t = provider + 1; t < TAGE_NR_TABLE; t ++) {
+      TageEntry *e = &tage_table[t][idx[t]];
+      if (e->u == 0) {
+        *e = (TageEntry) { .tag = tag[t], .ctr = (taken ? 0 : -1), .u = 0 };
+        allocated = true;
+        break;
+      }
+    }
+    if (!allocated) {
+      for (t = provider + 1; t < TAGE_NR_TABLE; t ++) {
+        TageEntry *e = &tage_table[t][idx[t]];
+        if (e->u > 0) e->u --;
+      }
+    }
+  }
+  return direction_result(pred, taken);
+}
+#endif
+
+/* BTB and RAS: predict the target of taken branches and jumps */
+#ifdef CONFIG_BPRED_BTB
+#define BTB_SIZE (1u << CONFIG_BPRED_BTB_SHIFT)
+
+typedef struct {
+  vaddr_t pc;
+  vaddr_t target;
+} BTBEntry;
+
+static BTBEntry btb[BTB_SIZE];
+static vaddr_t ras[CONFIG_BPRED_RAS_SIZE];
+static int ras_top = 0;
+
+static int btb_step(Decode *s, int type) {
+  // the target of a not-taken branch is the next instruction
+  if (type == BR_COND && s->dnpc == s->snpc) return PRED_SKIP;
+  vaddr_t pred;
+  if (type == BR_RET) {
+    pred = ras[ras_top];
+    ras_top = (ras_top + CONFIG_BPRED_RAS_SIZE - 1) % CONFIG_BPRED_RAS_SIZE;
+  } else {
+    BTBEntry *e = &btb[PC_INDEX(s->pc) & (BTB_SIZE - 1)];
+    pred = (e->pc == s->pc ? e->target : s->snpc);
+    *e = (BTBEntry) { .pc = s->pc, .target = s->dnpc };
+  }
+  if (type == BR_CALL) {
+    ras_top = (ras_top + 1) % CONFIG_BPRED_RAS_SIZE;
+    ras[ras_top] = s->snpc;
+  }
+  return (pred == s->dnpc ? PRED_HIT : PRED_MISS);
+}
+#endif
+
+typedef struct {
+  const char *name;
+  int (*step)(Decode *s, int type);
+  uint64_t lookup;
+  uint64_t miss;
+} BPredModel;
+
+static BPredModel models[] = {
+  IFDEF(CONFIG_BPRED_BIMODAL, { "bimodal", bimodal_step },)
+  IFDEF(CONFIG_BPRED_GSHARE,  { "gshare",  gshare_step },)
+  IFDEF(CONFIG_BPRED_TAGE,    { "TAGE",    tage_step },)
+  IFDEF(CONFIG_BPRED_BTB,     { "BTB+RAS", btb_step },)
+};
+
+void bpred_update(Decode *s) {
+  int type = isa_branch_type(s);
+  if (likely(type == BR_NONE)) return;
+  int i;
+  for (i = 0; i < ARRLEN(models); i ++) {
+    int ret = models[i].step(s, type);
+    if (ret == PRED_SKIP) continue;
+    models[i].lookup ++;
+    if (ret == PRED_MISS) models[i].miss ++;
+  }
+  if (type == BR_COND) ghist = (ghist << 1) | (s->dnpc != s->snpc);
+}
+
+void bpred_display() {
+  int i;
+  for (i = 0; i < ARRLEN(models); i ++) {
+    BPredModel *m = &models[i];
+    if (m->lookup == 0) continue;
+    Log("branch predictor %-8s lookup = %" PRIu64 ", miss = %" PRIu64 ", accuracy = %.2f%%, MPKI = %.3f",
+        m->name, m->lookup, m->miss, (m->lookup - m->miss) * 100.0 / m->lookup,
+        m->miss * 1000.0 / g_nr_guest_inst);
+  }
+}
+
+#endif
@@ -16,6 +16,10 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/perf.h>
+#include <cpu/bpred.h>
+#include <cpu/iringbuf.h>
+#include <memory/cachesim.h>
 #include <locale.h>
 #include "../monitor/sdb/watchpoint.h"
 #include "utils.h"
@@ -33,13 +37,19 @@ static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+void serial_flush();
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+  int perf = perf_enter(PERF_TRACE);
 #ifdef CONFIG_ITRACE_COND
   if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
 #endif
   if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+#ifdef CONFIG_DIFFTEST
+  perf_enter(PERF_DIFFTEST);
+  difftest_step(_this, dnpc);
+  perf_enter(PERF_TRACE);
+#endif
 
 #ifdef CONFIG_WATCHPOINT    // 检查监视点的代码块
   WP *head = NULL;
@@ -64,14 +74,19 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
       nemu_state.state = NEMU_STOP;
   }
 #endif
+  perf_leave(perf);
 }
 
 static void exec_once (Decode *s, vaddr_t pc) {
   s->pc   = pc;
   s->snpc = pc;
+  int perf = perf_enter (PERF_EXEC);
   isa_exec_once (s);
   cpu.pc = s->dnpc;
+  bpred_update (s);
+  iringbuf_record (s);
 #ifdef CONFIG_ITRACE
+  perf_enter (PERF_TRACE);
   char *p       = s->logbuf;
   p             += snprintf (p, sizeof (s->logbuf), FMT_WORD ":", s->pc);
   int      ilen = s->snpc - s->pc;
@@ -92,17 +107,26 @@ static void exec_once (Decode *s, vaddr_t pc) {
                MUXDEF (CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst.val,
                ilen);
 #endif
+  perf_leave (perf);
 }
 
 static void execute (uint64_t n) {
   Decode s;
   for (; n > 0; n--) {
+      perf_sample (g_nr_guest_inst);
       exec_once (&s, cpu.pc);
       g_nr_guest_inst++;
       trace_and_difftest (&s, cpu.pc);
       if (nemu_state.state != NEMU_RUNNING) break;
-      IFDEF (CONFIG_DEVICE, device_update());
+#ifdef CONFIG_DEVICE
+      int perf = perf_enter (PERF_DEVICE);
+      device_update();
+      perf_leave (perf);
+#endif
   }
+  perf_sample_end();
+  difftest_sync();
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
 }
 
 static void statistic () {
@@ -116,9 +140,14 @@ static void statistic () {
   else
       Log ("Finish running in less than 1 us and can not calculate the simulation "
            "frequency");
+  IFDEF (CONFIG_PERF, perf_display());
+  IFDEF (CONFIG_CACHESIM, cachesim_display());
+  IFDEF (CONFIG_BPRED, bpred_display());
 }
 
 void assert_fail_msg () {
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
+  iringbuf_display();
   isa_reg_display();
   statistic();
 }
@@ -154,6 +183,7 @@ void cpu_exec (uint64_t n) {
                    : (nemu_state.halt_ret == 0 ? ANSI_FMT ("HIT GOOD TRAP", ANSI_FG_GREEN)
                                                : ANSI_FMT ("HIT BAD TRAP", ANSI_FG_RED))),
               nemu_state.halt_pc);
+          if (nemu_state.state == NEMU_ABORT) iringbuf_display();
           // fall through
       case NEMU_QUIT: statistic();
   }
@@ -17,7 +17,10 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/difftest.h>
 #include <memory/paddr.h>
+#include <memory/host.h>
 #include <utils.h>
 #include <difftest-def.h>
 
@@ -25,11 +28,96 @@ void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) =
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_commit)(DifftestCommit *c) = NULL;
+uint64_t (*ref_difftest_memhash)(paddr_t addr, size_t n) = NULL;
+void (*ref_difftest_exec_until)(uint64_t n, uint64_t pc, uint64_t nr_hit) = NULL;
+void (*ref_difftest_csrcpy)(void *csr, bool direction) = NULL;
+size_t (*ref_difftest_dirty_pages)(paddr_t *page, size_t max) = NULL;
+bool (*ref_difftest_mmio)(DifftestMMIO *ev, int n) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
+extern uint64_t g_nr_guest_inst;
+
+/* The device accesses of an instruction are passed to the REF before it
+ * runs the instruction, and the REF replays them instead of accessing its
+ * own devices. The instruction is skipped if the REF can not do this.
+ */
+#define MAX_MMIO_PER_INST 16
+static DifftestMMIO inst_mmio[MAX_MMIO_PER_INST];
+static int nr_inst_mmio = 0;
+
+#ifdef CONFIG_DIFFTEST_BATCH
+/* In the batched mode the REF only runs when a batch is checked. The DUT
+ * keeps its register state after each instruction of the batch and an
+ * undo log of its stores, so that a mismatched batch can be replayed on
+ * the REF from the last sync point to find the first wrong instruction.
+ */
+#define BATCH_SIZE CONFIG_DIFFTEST_BATCH_SIZE
+#define MAX_STORE_PER_INST 16
+#define NR_STORE_LOG (BATCH_SIZE * 2 + MAX_STORE_PER_INST)
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  int idx; // index of the instruction in the batch
+  word_t old_data;
+  word_t new_data;
+} StoreLog;
+
+static CPU_state sync_point = {};
+static CPU_state batch[BATCH_SIZE];
+static int nr_batch = 0;
+static StoreLog store_log[NR_STORE_LOG];
+static int nr_store_log = 0;
+
+#define NR_BATCH_MMIO (BATCH_SIZE + MAX_MMIO_PER_INST)
+static DifftestMMIO batch_mmio[NR_BATCH_MMIO];
+static int batch_mmio_idx[NR_BATCH_MMIO]; // index of the instruction in the batch
+static int nr_batch_mmio = 0;
+#endif
+
+#ifdef CONFIG_DIFFTEST_PIPELINE
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* In the pipelined mode the REF runs on its own thread. The DUT passes the
+ * commit record of each instruction through a single-producer ring, and
+ * the REF thread applies it to a shadow copy of the DUT registers, so that
+ * the full register state can still be compared after each instruction.
+ * Writes missing from the commit records are caught by passing the whole
+ * DUT state every DIFFTEST_PIPELINE_FULL_INTERVAL instructions.
+ */
+#define PIPE_SIZE CONFIG_DIFFTEST_PIPELINE_SIZE
+
+enum { PIPE_STEP, PIPE_FULL, PIPE_SKIP };
+
+typedef struct {
+  int type;
+  DifftestCommit commit;
+  CPU_state state; // the DUT state for PIPE_FULL and PIPE_SKIP
+} PipeRecord;
+
+static PipeRecord pipe_ring[PIPE_SIZE];
+static uint64_t pipe_head = 0; // advanced by the DUT
+static uint64_t pipe_tail = 0; // advanced by the REF thread
+static bool pipe_fail = false;
+static bool pipe_reported = false;
+static CPU_state pipe_shadow = {};
+static CPU_state pipe_ref = {};
+static word_t pipe_ref_mdata = 0;
+static int pipe_nr_step = 0;
+
+static void *pipe_ref_thread(void *arg);
+#endif
+
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+// the REF is not run until the DUT reaches instruction `start_inst'
+static bool is_detach = false;
+static uint64_t start_inst = CONFIG_DIFFTEST_START;
+IFNDEF(CONFIG_DIFFTEST_LOCKSTEP, static int skip_dut_nr_ref = 0);
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
@@ -54,9 +142,23 @@ void difftest_skip_ref() {
 void difftest_skip_dut(int nr_ref, int nr_dut) {
   skip_dut_nr_inst += nr_dut;
 
+#ifndef CONFIG_DIFFTEST_LOCKSTEP
+  // the REF should not run before the pending instructions are checked,
+  // so this is deferred to difftest_step()
+  skip_dut_nr_ref += nr_ref;
+#else
   while (nr_ref -- > 0) {
     ref_difftest_exec(1);
   }
+#endif
+}
+
+// copy the registers to the REF, together with the CSRs if they are compared
+static void ref_regcpy(CPU_state *r) {
+  ref_difftest_regcpy(r, DIFFTEST_TO_REF);
+#ifdef CONFIG_DIFFTEST_CSR
+  if (ref_difftest_csrcpy != NULL) ref_difftest_csrcpy(r->csr, DIFFTEST_TO_REF);
+#endif
 }
 
 void init_difftest(char *ref_so_file, long img_size, int port) {
@@ -81,6 +183,48 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
+#ifdef CONFIG_DIFFTEST_COMMIT
+  // optional, the registers are compared instead if it is not provided
+  ref_difftest_commit = dlsym(handle, "difftest_commit");
+  if (ref_difftest_commit == NULL) {
+    Log("%s does not provide difftest_commit(), compare the registers instead", ref_so_file);
+  }
+#endif
+
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  // optional, the written pages are read back from the REF if it is not provided
+  ref_difftest_memhash = dlsym(handle, "difftest_memhash");
+  if (ref_difftest_memhash == NULL) {
+    Log("%s does not provide difftest_memhash(), read the memory back instead", ref_so_file);
+  }
+  // optional, the pages written by the REF are also compared if it is provided
+  ref_difftest_dirty_pages = dlsym(handle, "difftest_dirty_pages");
+#endif
+
+#ifdef CONFIG_DIFFTEST_CSR
+  // optional, only the registers are compared if it is not provided
+  ref_difftest_csrcpy = dlsym(handle, "difftest_csrcpy");
+  if (ref_difftest_csrcpy == NULL) {
+    Log("%s does not provide difftest_csrcpy(), the CSRs are not compared", ref_so_file);
+  }
+#endif
+
+#ifndef CONFIG_DIFFTEST_PIPELINE
+  // optional, the instructions accessing devices are skipped if it is not provided
+  ref_difftest_mmio = dlsym(handle, "difftest_mmio");
+  if (ref_difftest_mmio != NULL) {
+    Log("The device accesses are replayed by %s with difftest_mmio()", ref_so_file);
+  }
+#endif
+
+#ifdef CONFIG_DIFFTEST_BATCH
+  // optional, let the REF run to the end of a batch without stepping
+  ref_difftest_exec_until = dlsym(handle, "difftest_exec_until");
+  if (ref_difftest_exec_until != NULL) {
+    Log("%s runs to the end of each batch with difftest_exec_until()", ref_so_file);
+  }
+#endif
+
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
@@ -89,6 +233,22 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_init(port);
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+#ifdef CONFIG_DIFFTEST_CSR
+  // take the reset values of the CSRs from the REF, since some of their fields are read-only
+  if (ref_difftest_csrcpy != NULL) ref_difftest_csrcpy(cpu.csr, DIFFTEST_TO_DUT);
+#endif
+  IFDEF(CONFIG_DIFFTEST_BATCH, sync_point = cpu);
+  if (start_inst > 0) {
+    Log("Differential testing starts after %" PRIu64 " instructions", start_inst);
+    is_detach = true;
+  }
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  pipe_shadow = cpu;
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, pipe_ref_thread, NULL);
+  Assert(ret == 0, "Can not create the thread for the REF");
+  pthread_detach(thread);
+#endif
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
@@ -99,7 +259,118 @@ static void checkregs(CPU_state *ref, vaddr_t pc) {
   }
 }
 
-void difftest_step(vaddr_t pc, vaddr_t npc) {
+#ifdef CONFIG_DIFFTEST_COMMIT
+static int nr_commit_check = 0;
+
+static bool check_commit(DifftestCommit *ref, DifftestCommit *dut) {
+  if (ref->npc != dut->npc || ref->wreg != dut->wreg || ref->mlen != dut->mlen) return false;
+  if (dut->wreg != 0 && ref->wdata != dut->wdata) return false;
+  if (dut->mlen != 0) {
+    uint64_t mask = (dut->mlen < 8 ? BITMASK(dut->mlen * 8) : (uint64_t)-1);
+    if (ref->maddr != dut->maddr || ((ref->mdata ^ dut->mdata) & mask) != 0) return false;
+  }
+  return true;
+}
+
+static void commit_log(const char *name, DifftestCommit *c) {
+  Log("%s: npc = " FMT_WORD ", reg[%d] = " FMT_WORD ", store %d bytes " FMT_WORD " to " FMT_PADDR,
+      name, (vaddr_t)c->npc, c->wreg, (word_t)c->wdata, c->mlen, (word_t)c->mdata, (paddr_t)c->maddr);
+}
+#endif
+
+#ifdef CONFIG_DIFFTEST_MEMHASH
+/* The pages written by the DUT since the last check are kept in a list,
+ * and only these pages are hashed and compared with the REF.
+ */
+#define MEMHASH_PAGE_SHIFT 12
+#define MEMHASH_PAGE_SIZE (1 << MEMHASH_PAGE_SHIFT)
+#define NR_MEMHASH_PAGE (CONFIG_MSIZE >> MEMHASH_PAGE_SHIFT)
+
+static bool page_dirty[NR_MEMHASH_PAGE] = {};
+static uint32_t dirty_list[NR_MEMHASH_PAGE];
+static int nr_dirty = 0;
+IFDEF(CONFIG_DIFFTEST_LOCKSTEP, static int memhash_nr_inst = 0);
+static uint8_t ref_page[MEMHASH_PAGE_SIZE];
+static paddr_t ref_dirty[NR_MEMHASH_PAGE];
+
+static inline void memhash_mark(paddr_t addr) {
+  uint32_t idx = (addr - PMEM_LEFT) >> MEMHASH_PAGE_SHIFT;
+  if (!page_dirty[idx]) {
+    page_dirty[idx] = true;
+    dirty_list[nr_dirty ++] = idx;
+  }
+}
+
+static uint64_t ref_memhash(paddr_t page) {
+  if (ref_difftest_memhash != NULL) return ref_difftest_memhash(page, MEMHASH_PAGE_SIZE);
+  ref_difftest_memcpy(page, ref_page, MEMHASH_PAGE_SIZE, DIFFTEST_TO_DUT);
+  return difftest_hash(DIFFTEST_HASH_INIT, ref_page, MEMHASH_PAGE_SIZE);
+}
+
+static void memhash_report(paddr_t page) {
+  uint8_t *dut_page = guest_to_host(page);
+  int i;
+  ref_difftest_memcpy(page, ref_page, MEMHASH_PAGE_SIZE, DIFFTEST_TO_DUT);
+  for (i = 0; i < MEMHASH_PAGE_SIZE && ref_page[i] == dut_page[i]; i ++) ;
+  Log("The memory written before executing instruction at pc = " FMT_WORD " is different", cpu.pc);
+  if (i < MEMHASH_PAGE_SIZE) {
+    Log("memory at " FMT_PADDR ", right = 0x%02x, wrong = 0x%02x", page + i, ref_page[i], dut_page[i]);
+  } else {
+    Log("the hash of the page at " FMT_PADDR " is different, but the content is the same", page);
+  }
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = cpu.pc;
+}
+
+// compare the hash of the pages written since the last check
+static bool memhash_check() {
+  bool ok = (nemu_state.state != NEMU_ABORT);
+  int i;
+  if (ref_difftest_dirty_pages != NULL) {
+    // a page written by the REF only is also wrong
+    int nr_ref_dirty = ref_difftest_dirty_pages(ref_dirty, NR_MEMHASH_PAGE);
+    for (i = 0; i < nr_ref_dirty; i ++) {
+      if (in_pmem(ref_dirty[i])) memhash_mark(ref_dirty[i]);
+    }
+  }
+  for (i = 0; i < nr_dirty; i ++) {
+    uint32_t idx = dirty_list[i];
+    page_dirty[idx] = false;
+    if (!ok) continue;
+    paddr_t page = PMEM_LEFT + ((paddr_t)idx << MEMHASH_PAGE_SHIFT);
+    if (ref_memhash(page) != difftest_hash(DIFFTEST_HASH_INIT, guest_to_host(page), MEMHASH_PAGE_SIZE)) {
+      memhash_report(page);
+      ok = false;
+    }
+  }
+  nr_dirty = 0;
+  return ok;
+}
+#endif
+
+void difftest_device(paddr_t addr, int len, word_t data, bool is_write) {
+  if (ref_difftest_mmio == NULL || nr_inst_mmio == MAX_MMIO_PER_INST) {
+    difftest_skip_ref();
+    return;
+  }
+  inst_mmio[nr_inst_mmio ++] = (DifftestMMIO) { .addr = addr, .data = data,
+    .len = len, .is_write = is_write };
+}
+
+static void mmio_report(vaddr_t pc, DifftestMMIO *ev, int n) {
+  Log("The device accesses are different when executing instruction at pc = " FMT_WORD
+      ", those of the DUT are", pc);
+  int i;
+  for (i = 0; i < n; i ++) {
+    Log("  %s %d bytes " FMT_WORD " at " FMT_PADDR, ev[i].is_write ? "write" : "read",
+        ev[i].len, (word_t)ev[i].data, (paddr_t)ev[i].addr);
+  }
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = pc;
+}
+
+static void difftest_step_lockstep(Decode *s, vaddr_t npc) {
+  vaddr_t pc = s->pc;
   CPU_state ref_r;
 
   if (skip_dut_nr_inst > 0) {
@@ -117,16 +388,372 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
 
   if (is_skip_ref) {
     // to skip the checking of an instruction, just copy the reg state to reference design
-    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    ref_regcpy(&cpu);
     is_skip_ref = false;
     return;
   }
 
+  if (nr_inst_mmio > 0) ref_difftest_mmio(inst_mmio, nr_inst_mmio);
   ref_difftest_exec(1);
+  if (nr_inst_mmio > 0 && !ref_difftest_mmio(NULL, 0)) {
+    mmio_report(pc, inst_mmio, nr_inst_mmio);
+    return;
+  }
+
+#ifdef CONFIG_DIFFTEST_COMMIT
+  // compare what the instruction writes, and the whole registers once in a while
+  if (ref_difftest_commit != NULL && ++ nr_commit_check < CONFIG_DIFFTEST_COMMIT_FULL_INTERVAL) {
+    DifftestCommit ref_c = { .pc = pc };
+    ref_difftest_commit(&ref_c);
+    if (likely(check_commit(&ref_c, &s->commit))) return;
+    Log("The commit record is different after executing instruction at pc = " FMT_WORD, pc);
+    commit_log("right", &ref_c);
+    commit_log("wrong", &s->commit);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+  }
+  nr_commit_check = 0;
+#endif
+
   ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
   checkregs(&ref_r, pc);
 }
+
+#ifdef CONFIG_DIFFTEST_BATCH
+// whether the REF is in the state `r', with the CSRs if they are compared
+static bool batch_match(CPU_state *ref_r, CPU_state *r) {
+  ref_difftest_regcpy(ref_r, DIFFTEST_TO_DUT);
+  if (memcmp(ref_r, r, DIFFTEST_REG_SIZE) != 0) return false;
+#ifdef CONFIG_DIFFTEST_CSR
+  if (ref_difftest_csrcpy != NULL) {
+    ref_difftest_csrcpy(ref_r->csr, DIFFTEST_TO_DUT);
+    return memcmp(ref_r->csr, r->csr, sizeof(r->csr)) == 0;
+  }
+#endif
+  return true;
+}
+
+static void batch_locate() {
+  int i, d;
+  // roll back the stores of the DUT, and bring the REF back to the sync point
+  for (i = nr_store_log - 1; i >= 0; i --) {
+    host_write(guest_to_host(store_log[i].addr), store_log[i].len, store_log[i].old_data);
+  }
+  ref_difftest_memcpy(PMEM_LEFT, guest_to_host(PMEM_LEFT), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  ref_regcpy(&sync_point);
+
+  // replay the batch on the REF instruction by instruction
+  CPU_state ref_r;
+  int e = 0, e0 = 0;
+  bool mmio_ok = true;
+  for (d = 0; d < nr_batch; d ++) {
+    for (e0 = e; e < nr_batch_mmio && batch_mmio_idx[e] == d; e ++) ;
+    if (e > e0) ref_difftest_mmio(batch_mmio + e0, e - e0);
+    ref_difftest_exec(1);
+    if (e > e0 && !ref_difftest_mmio(NULL, 0)) { mmio_ok = false; break; }
+    if (!batch_match(&ref_r, &batch[d])) break;
+  }
+  if (d == nr_batch) d = nr_batch - 1;
+
+  // bring the DUT to the state after the mismatched instruction
+  for (i = 0; i < nr_store_log && store_log[i].idx <= d; i ++) {
+    host_write(guest_to_host(store_log[i].addr), store_log[i].len, store_log[i].new_data);
+  }
+  cpu = batch[d];
+  vaddr_t pc = (d == 0 ? sync_point.pc : batch[d - 1].pc);
+  Log("Replaying the batch of %d instructions, the first mismatch is at pc = " FMT_WORD,
+      nr_batch, pc);
+  if (!mmio_ok) mmio_report(pc, batch_mmio + e0, e - e0);
+  else checkregs(&ref_r, pc);
+  if (nemu_state.state != NEMU_ABORT) {
+    Log("The mismatch can not be reproduced by replaying");
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+  }
+}
+
+// let the REF run the pending instructions and check the final state
+static bool batch_sync() {
+  if (nr_batch == 0) return true;
+  CPU_state ref_r;
+  if (nr_batch_mmio > 0) ref_difftest_mmio(batch_mmio, nr_batch_mmio);
+  if (ref_difftest_exec_until != NULL) {
+    // the end of the batch may be reached several times within it
+    vaddr_t end = batch[nr_batch - 1].pc;
+    uint64_t nr_hit = 0;
+    int i;
+    for (i = 0; i < nr_batch; i ++) {
+      nr_hit += (batch[i].pc == end);
+    }
+    ref_difftest_exec_until(nr_batch, end, nr_hit);
+  } else {
+    ref_difftest_exec(nr_batch);
+  }
+  bool ok = batch_match(&ref_r, &batch[nr_batch - 1]);
+  if (nr_batch_mmio > 0) ok &= ref_difftest_mmio(NULL, 0);
+  if (ok) {
+    sync_point = batch[nr_batch - 1];
+    IFDEF(CONFIG_DIFFTEST_MEMHASH, ok = memhash_check());
+  }
+  else batch_locate();
+  nr_batch = 0;
+  nr_store_log = 0;
+  nr_batch_mmio = 0;
+  return ok;
+}
+
+static void batch_store(paddr_t addr, int len, word_t data) {
+  Assert(nr_store_log < NR_STORE_LOG, "too many stores in a batch");
+  store_log[nr_store_log ++] = (StoreLog) { .addr = addr, .len = len, .idx = nr_batch,
+    .old_data = host_read(guest_to_host(addr), len), .new_data = data };
+}
+
+static void difftest_sync_mode() {
+  batch_sync();
+}
+
+static void difftest_step_mode(Decode *s, vaddr_t npc) {
+  if (likely(!is_skip_ref && skip_dut_nr_inst == 0 && skip_dut_nr_ref == 0)) {
+    int i;
+    for (i = 0; i < nr_inst_mmio; i ++) {
+      batch_mmio[nr_batch_mmio] = inst_mmio[i];
+      batch_mmio_idx[nr_batch_mmio ++] = nr_batch;
+    }
+    batch[nr_batch ++] = cpu;
+    if (nr_batch == BATCH_SIZE || nr_store_log > NR_STORE_LOG - MAX_STORE_PER_INST ||
+        nr_batch_mmio > NR_BATCH_MMIO - MAX_MMIO_PER_INST) {
+      batch_sync();
+    }
+    return;
+  }
+
+  // the current instruction needs to be handled in lockstep,
+  // check the pending instructions before it first
+  if (!batch_sync()) return;
+  for (; skip_dut_nr_ref > 0; skip_dut_nr_ref --) {
+    ref_difftest_exec(1);
+  }
+  difftest_step_lockstep(s, npc);
+  sync_point = cpu;
+  nr_store_log = 0;
+}
+#elif defined(CONFIG_DIFFTEST_PIPELINE)
+static bool pipe_check(PipeRecord *r) {
+  if (r->type == PIPE_SKIP) {
+    pipe_shadow = r->state;
+    ref_regcpy(&pipe_shadow);
+    return true;
+  }
+
+  DifftestCommit *c = &r->commit;
+  ref_difftest_exec(1);
+  if (r->type == PIPE_FULL) {
+    pipe_shadow = r->state;
+  } else {
+    if (c->wreg != 0) ((word_t *)&pipe_shadow)[c->wreg] = c->wdata;
+    pipe_shadow.pc = c->npc;
+  }
+  ref_difftest_regcpy(&pipe_ref, DIFFTEST_TO_DUT);
+  if (memcmp(&pipe_ref, &pipe_shadow, DIFFTEST_REG_SIZE) != 0) return false;
+
+  if (c->mlen != 0) {
+    word_t mask = (c->mlen < sizeof(word_t) ? BITMASK(c->mlen * 8) : (word_t)-1);
+    pipe_ref_mdata = 0;
+    ref_difftest_memcpy(c->maddr, &pipe_ref_mdata, c->mlen, DIFFTEST_TO_DUT);
+    if (pipe_ref_mdata != (c->mdata & mask)) return false;
+  }
+  return true;
+}
+
+static void *pipe_ref_thread(void *arg) {
+  int idle = 0;
+  while (true) {
+    uint64_t tail = pipe_tail;
+    if (tail == __atomic_load_n(&pipe_head, __ATOMIC_ACQUIRE)) {
+      if (idle < 4096) idle ++;
+      else usleep(100); // the DUT is probably stopped
+      continue;
+    }
+    idle = 0;
+    if (!pipe_check(&pipe_ring[tail % PIPE_SIZE])) {
+      // leave the record in the ring for pipe_report()
+      __atomic_store_n(&pipe_fail, true, __ATOMIC_RELEASE);
+      return NULL;
+    }
+    __atomic_store_n(&pipe_tail, tail + 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void pipe_report() {
+  if (pipe_reported) return;
+  pipe_reported = true;
+  DifftestCommit *c = &pipe_ring[pipe_tail % PIPE_SIZE].commit;
+  Log("The DUT is %" PRIu64 " instructions ahead of the REF when the mismatch is found",
+      pipe_head - pipe_tail - 1);
+  // show the registers of the DUT right after the wrong instruction
+  cpu = pipe_shadow;
+  checkregs(&pipe_ref, c->pc);
+  if (nemu_state.state != NEMU_ABORT) {
+    Log("store to " FMT_PADDR " is different after executing instruction at pc = " FMT_WORD
+        ", right = " FMT_WORD ", wrong = " FMT_WORD, (paddr_t)c->maddr, (vaddr_t)c->pc,
+        pipe_ref_mdata, (word_t)c->mdata);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = c->pc;
+  }
+}
+
+// wait for the REF thread to check all instructions in the pipeline
+static bool pipe_sync() {
+  while (__atomic_load_n(&pipe_tail, __ATOMIC_ACQUIRE) != pipe_head) {
+    if (__atomic_load_n(&pipe_fail, __ATOMIC_ACQUIRE)) break;
+    sched_yield();
+  }
+  if (__atomic_load_n(&pipe_fail, __ATOMIC_ACQUIRE)) {
+    pipe_report();
+    return false;
+  }
+  return true;
+}
+
+static void difftest_sync_mode() {
+  pipe_sync();
+}
+
+static void difftest_step_mode(Decode *s, vaddr_t npc) {
+  if (likely(skip_dut_nr_inst == 0 && skip_dut_nr_ref == 0)) {
+    while (pipe_head - __atomic_load_n(&pipe_tail, __ATOMIC_ACQUIRE) == PIPE_SIZE) {
+      if (__atomic_load_n(&pipe_fail, __ATOMIC_ACQUIRE)) break;
+      sched_yield(); // the pipeline is full
+    }
+    if (unlikely(__atomic_load_n(&pipe_fail, __ATOMIC_ACQUIRE))) {
+      pipe_report();
+      return;
+    }
+    PipeRecord *r = &pipe_ring[pipe_head % PIPE_SIZE];
+    if (is_skip_ref) {
+      r->type = PIPE_SKIP;
+      r->state = cpu;
+      is_skip_ref = false;
+    } else if (++ pipe_nr_step == CONFIG_DIFFTEST_PIPELINE_FULL_INTERVAL) {
+      r->type = PIPE_FULL;
+      r->commit = s->commit;
+      r->state = cpu;
+      pipe_nr_step = 0;
+    } else {
+      r->type = PIPE_STEP;
+      r->commit = s->commit;
+    }
+    __atomic_store_n(&pipe_head, pipe_head + 1, __ATOMIC_RELEASE);
+    return;
+  }
+
+  // catching up with the REF after difftest_skip_dut() is done in lockstep
+  if (!pipe_sync()) return;
+  for (; skip_dut_nr_ref > 0; skip_dut_nr_ref --) {
+    ref_difftest_exec(1);
+  }
+  difftest_step_lockstep(s, npc);
+  pipe_shadow = cpu;
+}
+#else
+static void difftest_sync_mode() {
+  IFDEF(CONFIG_DIFFTEST_MEMHASH, memhash_check());
+}
+
+static void difftest_step_mode(Decode *s, vaddr_t npc) {
+  difftest_step_lockstep(s, npc);
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  // the REF may be ahead of the DUT when catching up with it
+  if (++ memhash_nr_inst >= CONFIG_DIFFTEST_MEMHASH_INTERVAL && skip_dut_nr_inst == 0) {
+    memhash_nr_inst = 0;
+    memhash_check();
+  }
+#endif
+}
+#endif
+
+void difftest_sync() {
+  if (!is_detach) difftest_sync_mode();
+}
+
+void difftest_step(Decode *s, vaddr_t npc) {
+  if (unlikely(is_detach)) {
+    nr_inst_mmio = 0;
+    if (g_nr_guest_inst == start_inst) difftest_attach();
+    return;
+  }
+  difftest_step_mode(s, npc);
+  nr_inst_mmio = 0;
+}
+
+// stop running the REF, the instructions executed meanwhile are not checked
+void difftest_detach() {
+  difftest_sync();
+  is_detach = true;
+}
+
+// copy the whole state of the DUT to the REF, and check from here on
+void difftest_attach() {
+  if (nemu_state.state == NEMU_ABORT) return;
+  // the pending instructions of the REF would be lost by the copy below
+  if (!is_detach) return;
+  Log("Differential testing is attached at pc = " FMT_WORD " after %" PRIu64 " instructions",
+      cpu.pc, g_nr_guest_inst);
+  ref_difftest_memcpy(PMEM_LEFT, guest_to_host(PMEM_LEFT), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  ref_regcpy(&cpu);
+  isa_difftest_attach();
+
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+  IFNDEF(CONFIG_DIFFTEST_LOCKSTEP, skip_dut_nr_ref = 0);
+#ifdef CONFIG_DIFFTEST_BATCH
+  sync_point = cpu;
+  nr_batch = 0;
+  nr_store_log = 0;
+  nr_batch_mmio = 0;
+#endif
+  IFDEF(CONFIG_DIFFTEST_PIPELINE, pipe_shadow = cpu);
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  // the REF has the same memory now, and the pages it wrote before are stale
+  if (ref_difftest_dirty_pages != NULL) ref_difftest_dirty_pages(ref_dirty, NR_MEMHASH_PAGE);
+  int i;
+  for (i = 0; i < nr_dirty; i ++) page_dirty[dirty_list[i]] = false;
+  nr_dirty = 0;
+#endif
+  is_detach = false;
+}
+
+// run without the REF until the DUT has executed `n' instructions in total
+void difftest_start_at(uint64_t n) {
+  start_inst = n;
+  if (n > g_nr_guest_inst) difftest_detach();
+  else difftest_attach();
+}
+
+// called before a device writes pmem, so that the REF catches up with
+// the instructions before while it still sees the old memory
+void difftest_dma_begin() {
+  if (is_detach) return;
+  difftest_sync_mode();
+}
+
+// the memory written by a device is copied to the REF
+void difftest_dma(paddr_t addr, size_t n) {
+  if (is_detach) return;
+  ref_difftest_memcpy(addr, guest_to_host(addr), n, DIFFTEST_TO_REF);
+}
+
+#if defined(CONFIG_DIFFTEST_BATCH) || defined(CONFIG_DIFFTEST_MEMHASH)
+void difftest_store(paddr_t addr, int len, word_t data) {
+  if (is_detach) return;
+  IFDEF(CONFIG_DIFFTEST_BATCH, batch_store(addr, len, data));
+#ifdef CONFIG_DIFFTEST_MEMHASH
+  memhash_mark(addr);
+  memhash_mark(addr + len - 1);
+#endif
+}
+#endif
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
 #endif
@@ -34,6 +34,10 @@ void difftest_raise_intr(word_t NO) {
   assert(0);
 }
 
+uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  return difftest_hash(DIFFTEST_HASH_INIT, guest_to_host(addr), n);
+}
+
 void difftest_init(int port) {
   /* Perform ISA dependent initialization. */
   init_isa();
@@ -0,0 +1,78 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/decode.h>
+#include <cpu/iringbuf.h>
+
+#ifdef CONFIG_IRINGBUF
+
+/* The last instructions executed, kept in a fixed ring so that recording
+ * one is only a few stores. They are disassembled when being displayed.
+ */
+#define IRINGBUF_SIZE (1u << CONFIG_IRINGBUF_SHIFT)
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t inst;
+  uint8_t ilen;
+  uint8_t wreg;
+  word_t wdata;
+} IRingEntry;
+
+static IRingEntry iringbuf[IRINGBUF_SIZE];
+static uint64_t iringbuf_nr = 0;
+
+void iringbuf_record(Decode *s) {
+  IRingEntry *e = &iringbuf[iringbuf_nr ++ % IRINGBUF_SIZE];
+  e->pc = s->pc;
+  e->inst = s->isa.inst.val;
+  e->ilen = s->snpc - s->pc;
+  e->wreg = s->commit.wreg;
+  e->wdata = s->commit.wdata;
+}
+
+void init_disasm(const char *triple);
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+
+void iringbuf_display() {
+  if (iringbuf_nr == 0) return;
+#ifndef CONFIG_ITRACE
+  // the disassembler is only initialized by the monitor for itrace
+  static bool disasm_ready = false;
+  if (!disasm_ready) {
+    init_disasm(MUXDEF(CONFIG_ISA_x86, "i686", MUXDEF(CONFIG_ISA_mips32, "mipsel",
+          MUXDEF(CONFIG_ISA64, "riscv64", "riscv32"))) "-pc-linux-gnu");
+    disasm_ready = true;
+  }
+#endif
+
+  uint64_t n = (iringbuf_nr < IRINGBUF_SIZE ? iringbuf_nr : IRINGBUF_SIZE);
+  printf("The last %" PRIu64 " instructions executed:\n", n);
+  uint64_t i;
+  for (i = iringbuf_nr - n; i < iringbuf_nr; i ++) {
+    IRingEntry *e = &iringbuf[i % IRINGBUF_SIZE];
+    char asm_buf[128];
+    disassemble(asm_buf, sizeof(asm_buf), MUXDEF(CONFIG_ISA_x86, e->pc + e->ilen, e->pc), (uint8_t *)&e->inst, e->ilen);
+    char *t = strchr(asm_buf, '\t');
+    if (t != NULL) *t = ' ';
+    printf("%s " FMT_WORD ": %08" PRIx64 "  %-28s", (i == iringbuf_nr - 1 ? "-->" : "   "),
+        e->pc, e->inst, asm_buf);
+    if (e->wreg != 0) printf(" x%d <- " FMT_WORD, e->wreg, e->wdata);
+    putchar('\n');
+  }
+}
+
+#endif
@@ -0,0 +1,69 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/perf.h>
+
+#ifdef CONFIG_PERF
+
+bool perf_sampling = false;
+int perf_phase = PERF_LOOP;
+uint64_t perf_last = 0;
+uint64_t perf_cycles[NR_PERF] = {};
+
+static uint64_t nr_sample = 0;
+
+static const char *perf_name[NR_PERF] = {
+  [PERF_LOOP]     = "loop",
+  [PERF_FETCH]    = "fetch",
+  [PERF_EXEC]     = "decode+exec",
+  [PERF_MEM]      = "memory",
+  [PERF_MMIO]     = "mmio",
+  [PERF_DEVICE]   = "device",
+  [PERF_TRACE]    = "trace",
+  [PERF_DIFFTEST] = "difftest",
+};
+
+void perf_sample_begin() {
+  perf_sampling = true;
+  perf_phase = PERF_LOOP;
+  perf_last = perf_clock();
+  nr_sample ++;
+}
+
+void perf_sample_end() {
+  if (!perf_sampling) return;
+  perf_enter(PERF_LOOP);
+  perf_sampling = false;
+}
+
+void perf_display() {
+  uint64_t total = 0;
+  int i;
+  for (i = 0; i < NR_PERF; i ++) {
+    total += perf_cycles[i];
+  }
+  if (total == 0) {
+    Log("no instruction has been profiled yet");
+    return;
+  }
+  Log("profiled instructions = %" PRIu64 " (one out of %d), host cycles per instruction = %.1f",
+      nr_sample, 1 << CONFIG_PERF_SAMPLE_SHIFT, (double)total / nr_sample);
+  for (i = 0; i < NR_PERF; i ++) {
+    Log("  %-12s %5.1f%% %8.1f cycles/inst", perf_name[i],
+        perf_cycles[i] * 100.0 / total, (double)perf_cycles[i] / nr_sample);
+  }
+}
+
+#endif
@@ -30,7 +30,79 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+/* The stream buffer is a ring. The guest appends samples to its free
+ * space and then adds their size to reg_count, while the SDL audio
+ * callback consumes them from `sbuf_rpos' on the audio thread. Only
+ * `sbuf_count' is shared by both threads, and it is updated atomically,
+ * so neither side takes a lock.
+ */
+static uint32_t sbuf_count = 0;
+static uint32_t sbuf_rpos = 0; // only used by the audio thread
+// reg_count last read by the guest, its write is relative to this value
+static uint32_t count_seen = 0;
+static bool audio_ok = false;
+static bool audio_sdl_ok = false;
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t count = __atomic_load_n(&sbuf_count, __ATOMIC_ACQUIRE);
+  uint32_t n = (len < count ? len : count);
+  uint32_t first = CONFIG_SB_SIZE - sbuf_rpos;
+  if (first > n) first = n;
+  memcpy(stream, sbuf + sbuf_rpos, first);
+  memcpy(stream + first, sbuf, n - first);
+  sbuf_rpos = (sbuf_rpos + n) % CONFIG_SB_SIZE;
+  __atomic_sub_fetch(&sbuf_count, n, __ATOMIC_RELEASE);
+  // play silence on underrun
+  if (n < len) memset(stream + n, 0, len - n);
+}
+
+static void audio_init() {
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;
+  s.userdata = NULL;
+  s.freq = audio_base[reg_freq];
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  if (audio_ok) {
+    // reopened with new parameters, the samples not played yet are dropped
+    SDL_CloseAudio();
+    audio_ok = false;
+  }
+  sbuf_rpos = 0;
+  sbuf_count = 0;
+  count_seen = 0;
+  audio_base[reg_count] = 0;
+  int ret = -1;
+  if (audio_sdl_ok) {
+    ret = SDL_OpenAudio(&s, NULL);
+    if (ret == 0) SDL_PauseAudio(0);
+  }
+  audio_ok = (ret == 0);
+  if (!audio_ok) Log("Can not open the audio device, the samples are dropped");
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init] != 0) audio_init();
+      break;
+    case reg_count:
+      if (is_write) {
+        uint32_t n = audio_base[reg_count] - count_seen;
+        if (n > CONFIG_SB_SIZE - count_seen) {
+          static bool overflow = false;
+          if (!overflow) Log("audio stream buffer overflow, the extra samples are dropped");
+          overflow = true;
+          n = CONFIG_SB_SIZE - count_seen;
+        }
+        if (audio_ok) __atomic_add_fetch(&sbuf_count, n, __ATOMIC_RELEASE);
+      } else {
+        count_seen = __atomic_load_n(&sbuf_count, __ATOMIC_ACQUIRE);
+        audio_base[reg_count] = count_seen;
+      }
+      break;
+  }
 }
 
 void init_audio() {
@@ -42,6 +114,13 @@ void init_audio() {
   add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
 #endif
 
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
+  audio_base[reg_count] = 0;
+  audio_base[reg_init] = 0;
+
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
+
+  // SDL is initialized on the main thread, the device is opened by the guest later
+  audio_sdl_ok = (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0);
 }
@@ -16,58 +16,101 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/event.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
 
 void init_map();
 void init_serial();
+void serial_update();
 void init_timer();
 void init_vga();
 void init_i8042();
 void init_audio();
 void init_disk();
+void disk_update();
 void init_sdcard();
 void init_alarm();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
+void vga_init_screen();
+bool vga_render();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
+#ifndef CONFIG_TARGET_AM
+static bool sdl_quit = false;
+
+static void sdl_handle_event(SDL_Event *event) {
+  switch (event->type) {
+    case SDL_QUIT:
+      __atomic_store_n(&sdl_quit, true, __ATOMIC_RELEASE);
+      break;
+#ifdef CONFIG_HAS_KEYBOARD
+    // If a key was pressed
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: {
+      uint8_t k = event->key.keysym.scancode;
+      bool is_keydown = (event->key.type == SDL_KEYDOWN);
+      send_key(k, is_keydown);
+      break;
+    }
+#endif
+    default: break;
   }
-  last = now;
+}
+#endif
+
+#ifdef CONFIG_SDL_THREAD
+#include <pthread.h>
 
+/* The SDL thread owns the window. It handles the events and draws the
+ * frames passed by vga_update_screen(), so the emulator never waits for
+ * the display. The subsystems of SDL are initialized by init_device()
+ * before this thread is created.
+ */
+static void* sdl_thread(void *arg) {
+  IFDEF(CONFIG_HAS_VGA, IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_init_screen()));
+  while (true) {
+    bool busy = false;
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+      sdl_handle_event(&event);
+      busy = true;
+    }
+    IFDEF(CONFIG_HAS_VGA, IFDEF(CONFIG_VGA_SHOW_SCREEN, busy |= vga_render()));
+    if (!busy) SDL_Delay(1);
+  }
+  return NULL;
+}
+#endif
+
+void device_update() {
+  event_update();
+}
+
+// the screen, the host events and the host I/O are refreshed TIMER_HZ times a second
+static void device_refresh(void *arg) {
+  IFDEF(CONFIG_HAS_SERIAL, serial_update());
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_DISK_THREAD, disk_update());
 
 #ifndef CONFIG_TARGET_AM
+#ifndef CONFIG_SDL_THREAD
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
-        break;
-#ifdef CONFIG_HAS_KEYBOARD
-      // If a key was pressed
-      case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
-        break;
-      }
+    sdl_handle_event(&event);
+  }
 #endif
-      default: break;
-    }
+  if (__atomic_load_n(&sdl_quit, __ATOMIC_ACQUIRE)) {
+    nemu_state.state = NEMU_QUIT;
   }
 #endif
 }
 
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+  // the events are handled by the SDL thread, keys are dropped when NEMU stops
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_SDL_THREAD)
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -86,4 +129,12 @@ void init_device() {
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
 
   IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  event_add(1000000 / TIMER_HZ, 1000000 / TIMER_HZ, device_refresh, NULL);
+
+#ifdef CONFIG_SDL_THREAD
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, sdl_thread, NULL);
+  Assert(ret == 0, "Can not create the SDL thread");
+  pthread_detach(thread);
+#endif
 }
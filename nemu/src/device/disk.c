@@ -14,6 +14,175 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <cpu/difftest.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef CONFIG_DISK_THREAD
+#include <pthread.h>
+#endif
+
+// The guest posts a request by writing the physical address of the buffer,
+// the first block and the number of blocks, then DISK_READ or DISK_WRITE
+// to reg_cmd. The blocks are copied between the image and the buffer at
+// once, and reg_status tells when the request is done.
+
+#define BLKSZ 512
+
+enum {
+  reg_blksz,  // RO, size of a block
+  reg_blkcnt, // RO, number of blocks of the image
+  reg_buf,
+  reg_blkno,
+  reg_count,
+  reg_cmd,
+  reg_status, // write anything to clear DISK_DONE and DISK_ERROR
+  nr_reg
+};
+
+enum { DISK_READ = 1, DISK_WRITE = 2 };
+
+#define DISK_BUSY  0x1
+#define DISK_DONE  0x2
+#define DISK_ERROR 0x4
+
+static uint32_t *disk_base = NULL;
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
+
+typedef struct {
+  paddr_t buf;
+  uint64_t off, len;
+  bool is_write;
+} DiskReq;
+
+static DiskReq req;
+
+static void disk_transfer(DiskReq *r) {
+  if (r->is_write) memcpy(img + r->off, guest_to_host(r->buf), r->len);
+  else memcpy(guest_to_host(r->buf), img + r->off, r->len);
+}
+
+// called on the emulator thread once the data have been copied
+static void disk_complete() {
+  if (!req.is_write) difftest_dma(req.buf, req.len);
+  disk_base[reg_status] = DISK_DONE;
+  extern void dev_raise_intr();
+  dev_raise_intr();
+}
+
+#ifdef CONFIG_DISK_THREAD
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool pending = false;
+static bool finished = false;
+
+static void *disk_thread(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (!pending) pthread_cond_wait(&cond, &lock);
+    pending = false;
+    pthread_mutex_unlock(&lock);
+    disk_transfer(&req);
+    pthread_mutex_lock(&lock);
+    __atomic_store_n(&finished, true, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void disk_start() {
+  pthread_mutex_lock(&lock);
+  pending = true;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+void disk_update() {
+  if (!__atomic_load_n(&finished, __ATOMIC_ACQUIRE)) return;
+  __atomic_store_n(&finished, false, __ATOMIC_RELAXED);
+  disk_complete();
+}
+#else
+static void disk_start() {
+  if (!req.is_write) difftest_dma_begin();
+  disk_transfer(&req);
+  disk_complete();
+}
+#endif
+
+static void disk_post(int cmd) {
+  if (disk_base[reg_status] & DISK_BUSY) {
+    Log("disk: the command is ignored since the last one is not done");
+    return;
+  }
+  uint64_t blkno = disk_base[reg_blkno], count = disk_base[reg_count];
+  req.buf = disk_base[reg_buf];
+  req.off = blkno * BLKSZ;
+  req.len = count * BLKSZ;
+  req.is_write = (cmd == DISK_WRITE);
+  if ((cmd != DISK_READ && cmd != DISK_WRITE) || req.len == 0 ||
+      req.off + req.len > img_size ||
+      !in_pmem(req.buf) || !in_pmem(req.buf + req.len - 1)) {
+    Log("disk: bad request cmd = %d, buf = " FMT_PADDR ", blkno = %" PRIu64 ", count = %" PRIu64,
+        cmd, req.buf, blkno, count);
+    disk_base[reg_status] = DISK_DONE | DISK_ERROR;
+    return;
+  }
+  disk_base[reg_status] = DISK_BUSY;
+  disk_start();
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(offset % 4 == 0);
+  switch (offset / 4) {
+    case reg_cmd: if (is_write) disk_post(disk_base[reg_cmd]); break;
+    case reg_status:
+      if (is_write) disk_base[reg_status] &= DISK_BUSY;
+#ifdef CONFIG_DISK_THREAD
+      else disk_update();
+#endif
+      break;
+    case reg_blksz: case reg_blkcnt:
+      if (is_write) panic("disk: register %d is read-only", offset / 4);
+      break;
+  }
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+  disk_base[reg_blksz] = BLKSZ;
+
+  const char *path = CONFIG_DISK_IMG_PATH;
+  if (path[0] == '\0') return;
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    Log("Can not find disk image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  Assert(ret == 0, "Can not stat '%s'", path);
+  img_size = st.st_size / BLKSZ * BLKSZ;
+  if (img_size > 0) {
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not mmap '%s'", path);
+  }
+  close(fd);
+  disk_base[reg_blkcnt] = img_size / BLKSZ;
+  Log("Disk image %s has %" PRIu64 " blocks", path, img_size / BLKSZ);
+
+#ifdef CONFIG_DISK_THREAD
+  pthread_t thread;
+  ret = pthread_create(&thread, NULL, disk_thread, NULL);
+  Assert(ret == 0, "Can not create the disk thread");
+  pthread_detach(thread);
+#endif
 }
@@ -0,0 +1,118 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/event.h>
+#include <utils.h>
+
+#define MAX_EVENT 32
+// the events are checked every so many calls of event_update(), i.e. instructions
+#define EVENT_QUANTUM 256
+
+typedef struct {
+  uint64_t when;
+  uint64_t period;
+  event_handler_t handler;
+  void *arg;
+  int id;
+} Event;
+
+// a min-heap on `when'
+static Event heap[MAX_EVENT] = {};
+static int nr_event = 0;
+static int next_id = 0;
+// the earliest `when', so that all devices share one comparison
+static uint64_t next_when = UINT64_MAX;
+static int quantum = EVENT_QUANTUM;
+
+static void swap(int i, int j) {
+  Event t = heap[i];
+  heap[i] = heap[j];
+  heap[j] = t;
+}
+
+static void sift_up(int i) {
+  while (i > 0 && heap[(i - 1) / 2].when > heap[i].when) {
+    swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void sift_down(int i) {
+  while (true) {
+    int min = i, l = 2 * i + 1, r = 2 * i + 2;
+    if (l < nr_event && heap[l].when < heap[min].when) min = l;
+    if (r < nr_event && heap[r].when < heap[min].when) min = r;
+    if (min == i) break;
+    swap(i, min);
+    i = min;
+  }
+}
+
+static void remove_at(int i) {
+  heap[i] = heap[-- nr_event];
+  if (i < nr_event) {
+    sift_up(i);
+    sift_down(i);
+  }
+}
+
+static void update_next_when() {
+  next_when = (nr_event > 0 ? heap[0].when : UINT64_MAX);
+}
+
+int event_add(uint64_t delay, uint64_t period, event_handler_t h, void *arg) {
+  // an event due now could be added by a handler again and again within event_update()
+  Assert(delay > 0, "the delay of an event must be positive");
+  Assert(nr_event < MAX_EVENT, "too many events");
+  int id = next_id ++;
+  int i = nr_event ++;
+  heap[i] = (Event) { .when = get_guest_time() + delay, .period = period,
+    .handler = h, .arg = arg, .id = id };
+  sift_up(i);
+  update_next_when();
+  return id;
+}
+
+void event_cancel(int id) {
+  int i;
+  for (i = 0; i < nr_event; i ++) {
+    if (heap[i].id == id) {
+      remove_at(i);
+      update_next_when();
+      return;
+    }
+  }
+}
+
+void event_update() {
+  if (likely(-- quantum > 0)) return;
+  quantum = EVENT_QUANTUM;
+  uint64_t now = get_guest_time();
+  if (likely(now < next_when)) return;
+
+  while (nr_event > 0 && heap[0].when <= now) {
+    // the heap is updated before the handler, which may add or cancel events
+    Event e = heap[0];
+    if (e.period != 0) {
+      // the periods missed by a slow host are skipped instead of run in a burst
+      heap[0].when = (e.when + e.period > now ? e.when + e.period : now + e.period);
+      sift_down(0);
+    } else {
+      remove_at(0);
+    }
+    e.handler(e.arg);
+  }
+  update_next_when();
+}
@@ -58,6 +58,7 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   paddr_t offset = addr - map->low;
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  difftest_device(addr, len, ret, false);
   return ret;
 }
 
@@ -66,5 +67,6 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
+  difftest_device(addr, len, data, true);
   invoke_callback(map->callback, offset, len, true);
 }
@@ -14,10 +14,9 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/mmio.h>
 #include <memory/paddr.h>
 
-#define NR_MAP 16
-
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
 
@@ -53,6 +52,15 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   nr_map ++;
 }
 
+/* lookup for the models of the memory system */
+int mmio_map_id(paddr_t addr) {
+  return find_mapid_by_addr(maps, nr_map, addr);
+}
+
+const char* mmio_map_name(int mapid) {
+  return (mapid >= 0 && mapid < nr_map ? maps[mapid].name : "unknown");
+}
+
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
   return map_read(addr, len, fetch_mmio_map(addr));
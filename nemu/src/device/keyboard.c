@@ -45,27 +45,33 @@ static void init_keymap() {
   MAP(_KEYS, SDL_KEYMAP)
 }
 
+/* The keys are sent by the thread handling the SDL events, which may not
+ * be the emulator, so the queue has a single producer and a single
+ * consumer, each of which only advances its own index.
+ */
 #define KEY_QUEUE_LEN 1024
 static int key_queue[KEY_QUEUE_LEN] = {};
 static int key_f = 0, key_r = 0;
 
 static void key_enqueue(uint32_t am_scancode) {
+  int r = (key_r + 1) % KEY_QUEUE_LEN;
+  if (r == __atomic_load_n(&key_f, __ATOMIC_ACQUIRE)) return; // full, drop the key
   key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  __atomic_store_n(&key_r, r, __ATOMIC_RELEASE);
 }
 
 static uint32_t key_dequeue() {
   uint32_t key = _KEY_NONE;
-  if (key_f != key_r) {
+  if (key_f != __atomic_load_n(&key_r, __ATOMIC_ACQUIRE)) {
     key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
+    __atomic_store_n(&key_f, (key_f + 1) % KEY_QUEUE_LEN, __ATOMIC_RELEASE);
   }
   return key;
 }
 
 void send_key(uint8_t scancode, bool is_keydown) {
-  if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != _KEY_NONE) {
+  if (__atomic_load_n(&nemu_state.state, __ATOMIC_RELAXED) == NEMU_RUNNING &&
+      keymap[scancode] != _KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
     key_enqueue(am_scancode);
   }
@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -28,8 +33,11 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
-// right after sending the actual read/write commands.
+// The driver must be modified to start PIO right after sending the actual
+// read/write commands, or to start a transfer with SDDMA, which is not a
+// register of bcm2835: writing the physical address of a buffer to it
+// copies all blocks of the command between the buffer and the card, then
+// sets SDHSTS_BLOCK_IRPT and raises an interrupt.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -37,24 +45,48 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC, SDDMA
 };
 
-static FILE *fp = NULL;
+#define SDHSTS_BLOCK_IRPT 0x200
+
+// the image is mapped, so holes of a sparse image are read as zeros
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
-static long blk_addr = 0;
+static uint64_t pos = 0; // position of the next SDDATA access in the image
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
+static uint32_t hsts = 0;
 
 static void prepare_rw(int is_write) {
-  blk_addr = base[SDARG];
+  pos = (uint64_t)base[SDARG] << 9;
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
 }
 
+static void sdcard_dma(paddr_t buf) {
+  uint64_t len = (uint64_t)blkcnt << 9;
+  Assert(in_pmem(buf) && in_pmem(buf + len - 1),
+      "sdcard DMA buffer [" FMT_PADDR ", +0x%" PRIx64 ") is out of pmem", buf, len);
+  if (pos + len > img_size) {
+    Log("sdcard DMA at 0x%" PRIx64 " is out of the image of 0x%" PRIx64 " bytes", pos, img_size);
+    len = (pos < img_size ? img_size - pos : 0);
+  }
+  if (write_cmd) memcpy(img + pos, guest_to_host(buf), len);
+  else {
+    difftest_dma_begin();
+    memcpy(guest_to_host(buf), img + pos, len);
+    difftest_dma(buf, len);
+  }
+  pos += len;
+  hsts |= SDHSTS_BLOCK_IRPT;
+  extern void dev_raise_intr();
+  dev_raise_intr();
+}
+
 static void sdcard_handle_cmd(int cmd) {
   switch (cmd) {
     case MMC_GO_IDLE_STATE: break;
@@ -98,6 +130,14 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
     case SDRSP2:
     case SDRSP3:
       break;
+    case SDHSTS:
+      // the bits written with 1 are cleared
+      if (is_write) hsts &= ~base[SDHSTS];
+      base[SDHSTS] = hsts;
+      break;
+    case SDDMA:
+      if (is_write) sdcard_dma(base[SDDMA]);
+      break;
     case SDDATA:
        if (read_ext_csd) {
          // See section 8.1 JEDEC Standard JED84-A441
@@ -109,11 +149,13 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if (pos + 4 <= img_size) {
+         if (!write_cmd) { base[SDDATA] = *(uint32_t *)(img + pos); }
+         else { *(uint32_t *)(img + pos) = base[SDDATA]; }
+       } else if (!write_cmd) {
+         base[SDDATA] = 0;
        }
+       pos += 4;
        addr += 4;
        break;
     default:
@@ -128,7 +170,19 @@ void init_sdcard() {
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, O_RDWR);
+  if (fd == -1) {
+    Log("Can not find sdcard image: %s", path);
+    return;
+  }
+  struct stat st;
+  int ret = fstat(fd, &st);
+  Assert(ret == 0, "Can not stat '%s'", path);
+  img_size = st.st_size;
+  if (img_size > 0) {
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not mmap '%s'", path);
+  }
+  close(fd);
 }
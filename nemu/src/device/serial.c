@@ -13,39 +13,201 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#define _GNU_SOURCE // for posix_openpt()
 #include <utils.h>
 #include <device/map.h>
+#ifndef CONFIG_TARGET_AM
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
-#define CH_OFFSET 0
+enum {
+  CH_OFFSET,  // RBR/THR, or DLL if LCR_DLAB
+  IER_OFFSET, // or DLM if LCR_DLAB
+  IIR_OFFSET, // FCR when written
+  LCR_OFFSET,
+  MCR_OFFSET,
+  LSR_OFFSET,
+  MSR_OFFSET,
+  SCR_OFFSET,
+  NR_OFFSET
+};
+
+#define IER_RDI   0x01 // interrupt when data is ready
+#define IIR_NONE  0x01
+#define IIR_RDI   0x04
+#define IIR_FIFO  0xc0
+#define FCR_CLEAR_RX 0x02
+#define LCR_DLAB  0x80
+#define LSR_DR    0x01
+#define LSR_THRE  0x20
+#define LSR_TEMT  0x40
 
 static uint8_t *serial_base = NULL;
+// IER and RBR/THR are shadowed by the divisor latch when LCR_DLAB is set
+static uint8_t reg_ier = 0, dll = 0, dlm = 0;
+
+// RX FIFO, larger than the 16 bytes of 16550 so that scripted input is not
+// limited by the rate of polling the host
+#define RX_FIFO_SIZE 256
+static uint8_t rx_fifo[RX_FIFO_SIZE];
+static int rx_head = 0, rx_count = 0;
+
+static void rx_clear() { rx_head = rx_count = 0; }
+
+static int rx_pop() {
+  if (rx_count == 0) return 0;
+  uint8_t ch = rx_fifo[rx_head];
+  rx_head = (rx_head + 1) % RX_FIFO_SIZE;
+  rx_count --;
+  return ch;
+}
+
+#ifdef CONFIG_TARGET_AM
+static void serial_putc(char ch) { putch(ch); }
+static void serial_rx_poll() {}
+void serial_flush() {}
+void serial_update() {}
+#else
+// The output is buffered and written to the host with one write(2) when
+// the buffer is full, at a newline if the output is interactive, at every
+// device_update(), when NEMU stops, and when NEMU exits or panics.
+static int out_fd = STDERR_FILENO;
+static bool out_tty = false;
+static char out_buf[CONFIG_SERIAL_BUF_SIZE];
+static int out_len = 0;
+
+void serial_flush() {
+  char *p = out_buf;
+  while (out_len > 0) {
+    ssize_t n = write(out_fd, p, out_len);
+    // nobody is reading the pty, drop the output instead of blocking
+    if (n <= 0) break;
+    p += n;
+    out_len -= n;
+  }
+  out_len = 0;
+}
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+// The input is read from stdin, from the pty of the output, or from a
+// named FIFO. The host is polled at every device_update(), and when the
+// guest has read all bytes, so that an idle guest costs no system call.
+static int in_fd = -1;
+
+static void serial_rx_poll() {
+  if (in_fd == -1 || rx_count == RX_FIFO_SIZE) return;
+  struct pollfd pfd = { .fd = in_fd, .events = POLLIN };
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) return;
+  int tail = (rx_head + rx_count) % RX_FIFO_SIZE;
+  int n = (tail < rx_head ? rx_head : RX_FIFO_SIZE) - tail;
+  ssize_t ret = read(in_fd, rx_fifo + tail, n);
+  if (ret <= 0) return;
+  rx_count += ret;
+  if (reg_ier & IER_RDI) {
+    extern void dev_raise_intr();
+    dev_raise_intr();
+  }
+}
 
+static void init_serial_input() {
+  const char *path = CONFIG_SERIAL_INPUT_PATH;
+  if (!strcmp(path, "stdin")) in_fd = STDIN_FILENO;
+  else if (!strcmp(path, "pty")) {
+    Assert(!strcmp(CONFIG_SERIAL_OUTPUT_PATH, "pty"),
+        "The input can only be read from the pty of the output");
+    in_fd = out_fd;
+  } else {
+    // keep the FIFO open for writing, so that it does not hang up
+    // when the writer exits
+    if (mkfifo(path, 0666) != 0) Assert(errno == EEXIST, "Can not create FIFO '%s'", path);
+    in_fd = open(path, O_RDWR | O_NONBLOCK);
+    Assert(in_fd != -1, "Can not open '%s'", path);
+  }
+  Log("Serial input is read from %s", path);
+}
+#else
+static void serial_rx_poll() {}
+#endif
+
+void serial_update() {
+  if (out_len > 0) serial_flush();
+  serial_rx_poll();
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  out_buf[out_len ++] = ch;
+  if (out_len == sizeof(out_buf) || (ch == '\n' && out_tty)) serial_flush();
 }
 
+static void init_serial_output() {
+  const char *path = CONFIG_SERIAL_OUTPUT_PATH;
+  if (!strcmp(path, "pty")) {
+    out_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    Assert(out_fd != -1 && grantpt(out_fd) == 0 && unlockpt(out_fd) == 0,
+        "Can not create a pty for the serial");
+    out_tty = true;
+    Log("Serial is connected to %s", ptsname(out_fd));
+  } else if (path[0] != '\0') {
+    out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    Assert(out_fd != -1, "Can not open '%s'", path);
+    Log("Serial output is written to %s", path);
+  } else {
+    out_tty = isatty(out_fd);
+  }
+  atexit(serial_flush);
+}
+#endif
+
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
-      if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      if (dlab) {
+        if (is_write) dll = serial_base[CH_OFFSET];
+        else serial_base[CH_OFFSET] = dll;
+      } else if (is_write) serial_putc(serial_base[CH_OFFSET]);
+      else {
+        serial_base[CH_OFFSET] = rx_pop();
+        if (rx_count == 0) serial_rx_poll();
+      }
+      break;
+    case IER_OFFSET:
+      if (!is_write) serial_base[IER_OFFSET] = (dlab ? dlm : reg_ier);
+      else if (dlab) dlm = serial_base[IER_OFFSET];
+      else reg_ier = serial_base[IER_OFFSET];
+      break;
+    case IIR_OFFSET:
+      if (is_write && (serial_base[IIR_OFFSET] & FCR_CLEAR_RX)) rx_clear();
+      serial_base[IIR_OFFSET] = IIR_FIFO |
+        ((reg_ier & IER_RDI) && rx_count > 0 ? IIR_RDI : IIR_NONE);
+      break;
+    case LSR_OFFSET:
+      // the output is buffered, so the transmitter is always empty
+      if (!is_write) serial_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT | (rx_count > 0 ? LSR_DR : 0);
       break;
+    case MSR_OFFSET: serial_base[MSR_OFFSET] = 0; break;
+    case LCR_OFFSET: case MCR_OFFSET: case SCR_OFFSET: break;
     default: panic("do not support offset = %d", offset);
   }
 }
 
 void init_serial() {
-  serial_base = new_space(8);
+  serial_base = new_space(NR_OFFSET);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("serial", CONFIG_SERIAL_PORT, serial_base, 8, serial_io_handler);
+  add_pio_map ("serial", CONFIG_SERIAL_PORT, serial_base, NR_OFFSET, serial_io_handler);
 #else
-  add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
+  add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, NR_OFFSET, serial_io_handler);
 #endif
 
+  IFNDEF(CONFIG_TARGET_AM, init_serial_output());
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_serial_input());
 }
@@ -34,6 +34,36 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+/* The bounding box of the pixels written since the last update, in
+ * [x0, x1) x [y0, y1). Only this box is uploaded to the screen.
+ */
+static int dirty_x0, dirty_y0, dirty_x1 = 0, dirty_y1 = 0;
+static int vga_w = 0, vga_h = 0; // screen_width() is a device read on AM
+
+static inline bool dirty_empty() {
+  return dirty_x0 >= dirty_x1;
+}
+
+static inline void dirty_reset() {
+  dirty_x0 = vga_w; dirty_x1 = 0;
+  dirty_y0 = vga_h; dirty_y1 = 0;
+}
+
+static inline void dirty_mark(uint32_t idx) {
+  int x = idx % vga_w, y = idx / vga_w;
+  if (x < dirty_x0) dirty_x0 = x;
+  if (x >= dirty_x1) dirty_x1 = x + 1;
+  if (y < dirty_y0) dirty_y0 = y;
+  if (y >= dirty_y1) dirty_y1 = y + 1;
+}
+
+static void vmem_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write) {
+    dirty_mark(offset / sizeof(uint32_t));
+    dirty_mark((offset + len - 1) / sizeof(uint32_t));
+  }
+}
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
@@ -41,51 +71,263 @@ static uint32_t *vgactl_port_base = NULL;
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
+void vga_init_screen() {
   SDL_Window *window = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
-  SDL_Init(SDL_INIT_VIDEO);
   SDL_CreateWindowAndRenderer(
       SCREEN_W * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
       SCREEN_H * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
       0, &window, &renderer);
   SDL_SetWindowTitle(window, title);
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-      SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
+      SDL_TEXTUREACCESS_STREAMING, SCREEN_W, SCREEN_H);
+}
+
+static void upload_texture(uint32_t *fb, SDL_Rect *rect) {
+  void *pixels;
+  int pitch;
+  SDL_LockTexture(texture, rect, &pixels, &pitch);
+  uint32_t *src = fb + rect->y * SCREEN_W + rect->x;
+  int y;
+  for (y = 0; y < rect->h; y ++) {
+    memcpy((uint8_t *)pixels + y * pitch, src + y * SCREEN_W, rect->w * sizeof(uint32_t));
+  }
+  SDL_UnlockTexture(texture);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static void present() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+#ifdef CONFIG_SDL_THREAD
+#include <pthread.h>
+
+/* The screen is drawn by the SDL thread. The dirty box of vmem is copied
+ * to the back buffer `frame', whose lock is only tried by the emulator,
+ * so it never waits for the texture upload or the vsync of present().
+ */
+static uint32_t frame[SCREEN_W * SCREEN_H];
+static SDL_Rect frame_box = {};
+static bool frame_dirty = false;
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// called by the emulator, return false if the SDL thread holds the frame
+static inline bool update_screen() {
+  if (pthread_mutex_trylock(&frame_lock) != 0) return false;
+  int y;
+  for (y = dirty_y0; y < dirty_y1; y ++) {
+    memcpy(frame + y * SCREEN_W + dirty_x0, (uint32_t *)vmem + y * SCREEN_W + dirty_x0,
+        (dirty_x1 - dirty_x0) * sizeof(uint32_t));
+  }
+  if (!frame_dirty) {
+    frame_box = (SDL_Rect) { .x = dirty_x0, .y = dirty_y0,
+      .w = dirty_x1 - dirty_x0, .h = dirty_y1 - dirty_y0 };
+  } else {
+    // merge with the box not drawn yet
+    int x1 = frame_box.x + frame_box.w, y1 = frame_box.y + frame_box.h;
+    if (dirty_x0 < frame_box.x) frame_box.x = dirty_x0;
+    if (dirty_y0 < frame_box.y) frame_box.y = dirty_y0;
+    if (dirty_x1 > x1) x1 = dirty_x1;
+    if (dirty_y1 > y1) y1 = dirty_y1;
+    frame_box.w = x1 - frame_box.x;
+    frame_box.h = y1 - frame_box.y;
+  }
+  frame_dirty = true;
+  pthread_mutex_unlock(&frame_lock);
+  return true;
+}
+
+// called by the SDL thread, return whether the screen is drawn
+bool vga_render() {
+  pthread_mutex_lock(&frame_lock);
+  bool dirty = frame_dirty;
+  if (dirty) {
+    upload_texture(frame, &frame_box);
+    frame_dirty = false;
+  }
+  pthread_mutex_unlock(&frame_lock);
+  if (dirty) present();
+  return dirty;
+}
 #else
-static void init_screen() {}
+static inline bool update_screen() {
+  SDL_Rect rect = { .x = dirty_x0, .y = dirty_y0,
+    .w = dirty_x1 - dirty_x0, .h = dirty_y1 - dirty_y0 };
+  upload_texture(vmem, &rect);
+  present();
+  return true;
+}
+#endif
+#else
+void vga_init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static inline bool update_screen() {
+  int w = dirty_x1 - dirty_x0, h = dirty_y1 - dirty_y0;
+  uint32_t *src = (uint32_t *)vmem + dirty_y0 * vga_w + dirty_x0;
+  if (w == vga_w) {
+    io_write(AM_GPU_FBDRAW, 0, dirty_y0, src, w, h, true);
+    return true;
+  }
+  int y;
+  for (y = 0; y < h; y ++) {
+    io_write(AM_GPU_FBDRAW, dirty_x0, dirty_y0 + y, src + y * vga_w, w, 1,
+        y == h - 1);
+  }
+  return true;
 }
 #endif
 #endif
 
+#ifdef CONFIG_VGA_CAPTURE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Every CONFIG_VGA_CAPTURE_INTERVAL-th synced frame is copied to a slot
+ * of a ring and written out by a worker thread, either as a PPM image or
+ * as a line in a hash log. The emulator only waits when all slots are in
+ * use, so no frame is dropped and the output is the same for each run.
+ */
+#define NR_CAPTURE_SLOT 4
+
+typedef struct {
+  uint64_t frame;
+  uint64_t nr_inst;
+  uint32_t fb[SCREEN_W * SCREEN_H];
+} CaptureSlot;
+
+static CaptureSlot capture_slot[NR_CAPTURE_SLOT];
+static uint64_t capture_head = 0; // advanced by the emulator
+static uint64_t capture_tail = 0; // advanced by the worker thread
+static uint64_t nr_frame = 0;
+IFDEF(CONFIG_VGA_CAPTURE_HASH, static FILE *capture_fp = NULL);
+
+static void capture_write(CaptureSlot *c) {
+#ifdef CONFIG_VGA_CAPTURE_HASH
+  uint64_t h = 0xcbf29ce484222325ull;
+  int i;
+  for (i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+    h = (h ^ (c->fb[i] & 0xffffff)) * 0x100000001b3ull;
+  }
+  fprintf(capture_fp, "frame %" PRIu64 " inst %" PRIu64 " hash %016" PRIx64 "\n",
+      c->frame, c->nr_inst, h);
+#else
+  char path[256], header[32];
+  snprintf(path, sizeof(path), "%s/frame-%06" PRIu64 ".ppm", CONFIG_VGA_CAPTURE_PATH, c->frame);
+  int hlen = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+  size_t size = hlen + SCREEN_W * SCREEN_H * 3;
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(fd != -1, "Can not open '%s'", path);
+  int ret = ftruncate(fd, size);
+  Assert(ret == 0, "Can not resize '%s'", path);
+  uint8_t *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(p != MAP_FAILED, "Can not mmap '%s'", path);
+  close(fd);
+  memcpy(p, header, hlen);
+  uint8_t *q = p + hlen;
+  int i;
+  for (i = 0; i < SCREEN_W * SCREEN_H; i ++) {
+    uint32_t px = c->fb[i]; // ARGB8888
+    *q ++ = px >> 16;
+    *q ++ = px >> 8;
+    *q ++ = px;
+  }
+  munmap(p, size);
+#endif
+}
+
+static void* capture_worker(void *arg) {
+  while (true) {
+    uint64_t tail = capture_tail;
+    if (tail == __atomic_load_n(&capture_head, __ATOMIC_ACQUIRE)) { usleep(1000); continue; }
+    capture_write(&capture_slot[tail % NR_CAPTURE_SLOT]);
+    __atomic_store_n(&capture_tail, tail + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void capture_frame() {
+  if (nr_frame ++ % CONFIG_VGA_CAPTURE_INTERVAL != 0) return;
+  while (capture_head - __atomic_load_n(&capture_tail, __ATOMIC_ACQUIRE) == NR_CAPTURE_SLOT) {
+    sched_yield(); // all slots are in use
+  }
+  extern uint64_t g_nr_guest_inst;
+  CaptureSlot *c = &capture_slot[capture_head % NR_CAPTURE_SLOT];
+  c->frame = nr_frame - 1;
+  c->nr_inst = g_nr_guest_inst;
+  memcpy(c->fb, vmem, sizeof(c->fb));
+  __atomic_store_n(&capture_head, capture_head + 1, __ATOMIC_RELEASE);
+}
+
+// the frame is captured at the sync write of the guest, so that each sync
+// is a frame and the capture does not depend on the speed of the host
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset <= 4 && offset + len > 4 && vgactl_port_base[1] != 0) {
+    capture_frame();
+  }
+}
+
+// wait for the worker thread to write all captured frames
+static void capture_flush() {
+  while (__atomic_load_n(&capture_tail, __ATOMIC_ACQUIRE) != capture_head) {
+    sched_yield();
+  }
+  IFDEF(CONFIG_VGA_CAPTURE_HASH, fflush(capture_fp));
+}
+
+static void init_capture() {
+#ifdef CONFIG_VGA_CAPTURE_HASH
+  capture_fp = fopen(CONFIG_VGA_CAPTURE_PATH, "w");
+  Assert(capture_fp, "Can not open '%s'", CONFIG_VGA_CAPTURE_PATH);
+#endif
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, capture_worker, NULL);
+  Assert(ret == 0, "Can not create the capture thread");
+  pthread_detach(thread);
+  atexit(capture_flush);
+  Log("Every %d-th frame is captured to %s", CONFIG_VGA_CAPTURE_INTERVAL, CONFIG_VGA_CAPTURE_PATH);
+}
+#endif
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[1] == 0) return;
+  if (!dirty_empty()) {
+    // retry at the next update if the screen is busy
+    if (!MUXDEF(CONFIG_VGA_SHOW_SCREEN, update_screen(), true)) return;
+    dirty_reset();
+  }
+  vgactl_port_base[1] = 0;
 }
 
 void init_vga() {
+  vga_w = screen_width();
+  vga_h = screen_height();
   vgactl_port_base = (uint32_t *)new_space(8);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8,
+      MUXDEF(CONFIG_VGA_CAPTURE, vgactl_io_handler, NULL));
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8,
+      MUXDEF(CONFIG_VGA_CAPTURE, vgactl_io_handler, NULL));
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_io_handler);
+  // the initial texture is undefined, so the whole screen is drawn at the first sync
+  dirty_x0 = 0; dirty_x1 = vga_w;
+  dirty_y0 = 0; dirty_y1 = vga_h;
+  // SDL is initialized on the main thread, but the window is created by
+  // the SDL thread, see device.c
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, SDL_Init(SDL_INIT_VIDEO));
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, IFNDEF(CONFIG_SDL_THREAD, vga_init_screen()));
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+  memset(vmem, 0, screen_size());
+#endif
+  IFDEF(CONFIG_VGA_CAPTURE, init_capture());
 }
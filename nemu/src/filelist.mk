@@ -26,3 +26,7 @@ ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
 endif
 SRCS-$(CONFIG_TARGET_AM) += src/am-bin.S
 .PHONY: src/am-bin.S
+
+ifdef CONFIG_DIFFTEST_PIPELINE
+LIBS += -lpthread
+endif
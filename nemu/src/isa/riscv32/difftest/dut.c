@@ -18,7 +18,24 @@
 #include "../local-include/reg.h"
 
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  return false;
+  bool ok = difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
+  int i;
+  for (i = 0; i < ARRLEN(cpu.gpr); i ++) {
+    ok &= difftest_check_reg(reg_name(i, 0), pc, ref_r->gpr[i], gpr(i));
+  }
+#ifdef CONFIG_DIFFTEST_CSR
+  if (ref_difftest_csrcpy != NULL) {
+    static const char *csr_name[] = {
+#define CSR_NAME(name, addr) #name,
+      DIFFTEST_CSR_LIST(CSR_NAME)
+    };
+    ref_difftest_csrcpy(ref_r->csr, DIFFTEST_TO_DUT);
+    for (i = 0; i < NR_DIFFTEST_CSR; i ++) {
+      ok &= difftest_check_reg(csr_name[i], pc, ref_r->csr[i], cpu.csr[i]);
+    }
+  }
+#endif
+  return ok;
 }
 
 void isa_difftest_attach() {
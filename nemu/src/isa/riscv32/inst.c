@@ -20,7 +20,7 @@
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
-#define Mw vaddr_write
+#define Mw(addr, len, data) mem_write(s, addr, len, data)
 
 enum {
   TYPE_I, TYPE_U, TYPE_S,
@@ -33,12 +33,23 @@ enum {
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
 
+static inline void mem_write(Decode *s, vaddr_t addr, int len, word_t data) {
+  vaddr_write(addr, len, data);
+#ifdef CONFIG_COMMIT_LOG
+  s->commit.maddr = addr;
+  s->commit.mlen = len;
+  s->commit.mdata = data;
+#endif
+}
+
 static void decode_operand(Decode *s, int *dest, word_t *src1, word_t *src2, word_t *imm, int type) {
   uint32_t i = s->isa.inst.val;
   int rd  = BITS(i, 11, 7);
   int rs1 = BITS(i, 19, 15);
   int rs2 = BITS(i, 24, 20);
   *dest = rd;
+  // only these types write rd, new types which do (e.g. R and J) should be added
+  IFDEF(CONFIG_COMMIT_LOG, s->commit.wreg = (type == TYPE_I || type == TYPE_U ? rd : 0));
   switch (type) {
     case TYPE_I: src1R();          immI(); break;
     case TYPE_U:                   immU(); break;
@@ -50,6 +61,7 @@ static int decode_exec(Decode *s) {
   int dest = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
   s->dnpc = s->snpc;
+  IFDEF(CONFIG_COMMIT_LOG, s->commit.mlen = 0);
 
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
@@ -68,9 +80,32 @@ static int decode_exec(Decode *s) {
 
   R(0) = 0; // reset $zero to 0
 
+#ifdef CONFIG_COMMIT_LOG
+  s->commit.pc = s->pc;
+  s->commit.npc = s->dnpc;
+  s->commit.wdata = R(s->commit.wreg);
+#endif
+
   return 0;
 }
 
+int isa_branch_type(Decode *s) {
+  uint32_t i = s->isa.inst.val;
+  int rd  = BITS(i, 11, 7);
+  int rs1 = BITS(i, 19, 15);
+  // x1 and x5 are link registers, see the hints for RAS in the ISA manual
+  bool rd_link  = (rd == 1 || rd == 5);
+  bool rs1_link = (rs1 == 1 || rs1 == 5);
+  switch (BITS(i, 6, 0)) {
+    case 0x63: return BR_COND;                          // beq, bne, ...
+    case 0x6f: return (rd_link ? BR_CALL : BR_JUMP);    // jal
+    case 0x67:                                          // jalr
+      if (rd_link) return BR_CALL;
+      return (rs1_link ? BR_RET : BR_INDIRECT);
+  }
+  return BR_NONE;
+}
+
 int isa_exec_once(Decode *s) {
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
   return decode_exec(s);
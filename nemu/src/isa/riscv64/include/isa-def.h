@@ -17,10 +17,12 @@
 #define __ISA_RISCV64_H__
 
 #include <common.h>
+#include <difftest-def.h>
 
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+  word_t csr[NR_DIFFTEST_CSR]; // in the order of DIFFTEST_CSR_LIST
 } riscv64_CPU_state;
 
 // decode
@@ -0,0 +1,152 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/cachesim.h>
+#include <memory/paddr.h>
+#include <device/mmio.h>
+
+#ifdef CONFIG_CACHESIM
+
+// region 0 is pmem, region 1 is the unmapped addresses, and region 2 + i
+// is the i-th MMIO map
+#define NR_REGION (2 + NR_MAP)
+
+/* A tag entry packs the line number with two state bits, and the ways of
+ * a set are adjacent. With LRU replacement the ways of a set are kept in
+ * MRU-to-LRU order, so a hit moves the entry to the front and a miss
+ * evicts the last one.
+ */
+#define LINE_VALID 0x1
+#define LINE_DIRTY 0x2
+#define LINE_TAG(line) (((uint64_t)(line) << 2) | LINE_VALID)
+
+typedef struct Cache {
+  const char *name;
+  uint64_t *tag;
+  uint32_t set_mask;
+  int nr_way;
+  struct Cache *next;   // the next level, NULL for memory
+  uint64_t access[NR_REGION];
+  uint64_t miss[NR_REGION];
+  uint64_t writeback;
+} Cache;
+
+static Cache icache = { .name = "L1 icache" };
+static Cache dcache = { .name = "L1 dcache" };
+IFDEF(CONFIG_CACHE_L2, static Cache l2cache = { .name = "L2 cache" });
+
+static void init_cache(Cache *c, int size_kb, int nr_way, Cache *next) {
+  uint64_t nr_line = ((uint64_t)size_kb << 10) >> CONFIG_CACHE_LINE_SHIFT;
+  Assert(nr_way > 0 && nr_line % nr_way == 0, "%s: %d ways do not fit in %d KB", c->name, nr_way, size_kb);
+  uint64_t nr_set = nr_line / nr_way;
+  Assert(nr_set > 0, "%s: %d ways of %d-byte lines do not fit in %d KB", c->name, nr_way,
+      1 << CONFIG_CACHE_LINE_SHIFT, size_kb);
+  Assert((nr_set & (nr_set - 1)) == 0, "%s: number of sets %" PRIu64 " is not a power of 2", c->name, nr_set);
+  c->tag = calloc(nr_line, sizeof(c->tag[0]));
+  assert(c->tag);
+  c->set_mask = nr_set - 1;
+  c->nr_way = nr_way;
+  c->next = next;
+  Log("%s: %d KB, %d-way, %" PRIu64 " sets, %d-byte lines", c->name, size_kb, nr_way,
+      nr_set, 1 << CONFIG_CACHE_LINE_SHIFT);
+}
+
+#ifdef CONFIG_CACHE_REPL_RANDOM
+static uint64_t xorshift() {
+  static uint64_t x = 88172645463325252ull;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return x;
+}
+#endif
+
+static void cache_access(Cache *c, uint64_t line, int region, bool is_write) {
+  uint64_t *set = c->tag + (line & c->set_mask) * c->nr_way;
+  uint64_t tag = LINE_TAG(line);
+  uint64_t dirty = (is_write ? LINE_DIRTY : 0);
+  int i;
+  c->access[region] ++;
+  for (i = 0; i < c->nr_way; i ++) {
+    if ((set[i] & ~LINE_DIRTY) == tag) {
+#ifdef CONFIG_CACHE_REPL_LRU
+      uint64_t hit = set[i];
+      memmove(set + 1, set, i * sizeof(set[0]));
+      set[0] = hit | dirty;
+#else
+      set[i] |= dirty;
+#endif
+      return;
+    }
+  }
+
+  c->miss[region] ++;
+  if (c->next != NULL) cache_access(c->next, line, region, false);
+#ifdef CONFIG_CACHE_REPL_LRU
+  int victim = c->nr_way - 1;
+  if (set[victim] & LINE_DIRTY) c->writeback ++;
+  memmove(set + 1, set, victim * sizeof(set[0]));
+  set[0] = tag | dirty;
+#else
+  int victim = xorshift() % c->nr_way;
+  if (set[victim] & LINE_DIRTY) c->writeback ++;
+  set[victim] = tag | dirty;
+#endif
+}
+
+void cachesim_access(int type, paddr_t addr, int len, bool is_write) {
+  int region = 0;
+  if (!in_pmem(addr)) region = 2 + MUXDEF(CONFIG_DEVICE, mmio_map_id(addr), -1);
+  Cache *c = (type == CACHE_I ? &icache : &dcache);
+  uint64_t line = addr >> CONFIG_CACHE_LINE_SHIFT;
+  uint64_t last = ((uint64_t)addr + len - 1) >> CONFIG_CACHE_LINE_SHIFT;
+  for (; line <= last; line ++) {
+    cache_access(c, line, region, is_write);
+  }
+}
+
+static void cache_display(Cache *c) {
+  uint64_t access = 0, miss = 0;
+  int i;
+  for (i = 0; i < NR_REGION; i ++) {
+    access += c->access[i];
+    miss += c->miss[i];
+  }
+  if (access == 0) return;
+  Log("%s: access = %" PRIu64 ", hit rate = %.2f%%, writeback = %" PRIu64,
+      c->name, access, (access - miss) * 100.0 / access, c->writeback);
+  for (i = 0; i < NR_REGION; i ++) {
+    if (c->access[i] == 0) continue;
+    Log("  %-12s access = %" PRIu64 ", hit rate = %.2f%%",
+        (i == 0 ? "pmem" : i == 1 ? "unmapped" : MUXDEF(CONFIG_DEVICE, mmio_map_name(i - 2), "unknown")),
+        c->access[i],
+        (c->access[i] - c->miss[i]) * 100.0 / c->access[i]);
+  }
+}
+
+void cachesim_display() {
+  cache_display(&icache);
+  cache_display(&dcache);
+  IFDEF(CONFIG_CACHE_L2, cache_display(&l2cache));
+}
+
+void init_cachesim() {
+  Cache *next = MUXDEF(CONFIG_CACHE_L2, &l2cache, NULL);
+  IFDEF(CONFIG_CACHE_L2, init_cache(&l2cache, CONFIG_L2CACHE_SIZE, CONFIG_L2CACHE_WAYS, NULL));
+  init_cache(&icache, CONFIG_ICACHE_SIZE, CONFIG_ICACHE_WAYS, next);
+  init_cache(&dcache, CONFIG_DCACHE_SIZE, CONFIG_DCACHE_WAYS, next);
+}
+
+#endif
@@ -17,6 +17,9 @@
 #include <memory/paddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <cpu/perf.h>
+#include <memory/cachesim.h>
+#include <cpu/difftest.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -33,6 +36,7 @@ static word_t pmem_read(paddr_t addr, int len) {
 }
 
 static void pmem_write(paddr_t addr, int len, word_t data) {
+  difftest_store(addr, len, data);
   host_write(guest_to_host(addr), len, data);
 }
 
@@ -54,17 +58,39 @@ void init_mem() {
   }
 #endif
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
+  init_cachesim();
+  init_mtrace();
 }
 
 word_t paddr_read(paddr_t addr, int len) {
-  if (likely(in_pmem(addr))) return pmem_read(addr, len);
-  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  if (likely(in_pmem(addr))) {
+    int perf = perf_enter_mem();
+    word_t ret = pmem_read(addr, len);
+    perf_leave(perf);
+    return ret;
+  }
+#ifdef CONFIG_DEVICE
+  int perf = perf_enter(PERF_MMIO);
+  word_t ret = mmio_read(addr, len);
+  perf_leave(perf);
+  return ret;
+#endif
   out_of_bound(addr);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
-  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  if (likely(in_pmem(addr))) {
+    int perf = perf_enter_mem();
+    pmem_write(addr, len, data);
+    perf_leave(perf);
+    return;
+  }
+#ifdef CONFIG_DEVICE
+  int perf = perf_enter(PERF_MMIO);
+  mmio_write(addr, len, data);
+  perf_leave(perf);
+  return;
+#endif
   out_of_bound(addr);
 }
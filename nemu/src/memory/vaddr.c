@@ -15,15 +15,22 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/cachesim.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
+  cachesim_access(CACHE_I, addr, len, false);
   return paddr_read(addr, len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  cachesim_access(CACHE_D, addr, len, false);
+  word_t data = paddr_read(addr, len);
+  mtrace_access(cpu.pc, addr, len, data, false);
+  return data;
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
+  cachesim_access(CACHE_D, addr, len, true);
+  mtrace_access(cpu.pc, addr, len, data, true);
   paddr_write(addr, len, data);
 }
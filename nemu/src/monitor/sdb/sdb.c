@@ -15,6 +15,8 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/perf.h>
+#include <cpu/difftest.h>
 #include <math.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -87,6 +89,16 @@ static int cmd_si(char *args) {
 }
 
 static int cmd_info(char *args) {
+    if (args == NULL) {
+        Log("命令info缺少参数");
+        return 0;
+    }
+#ifdef CONFIG_PERF
+    if (strcmp(args, "perf") == 0) {
+        perf_display();
+        return 0;
+    }
+#endif
     if (args[0] == 'r') {
         isa_reg_display();
     } else if (args[0] == 'w') {
@@ -162,6 +174,42 @@ static int cmd_d(char *args) {
     return 0;
 }
 
+#ifdef CONFIG_MTRACE
+static int cmd_mtrace(char *args) {
+    char *op = strtok(args, " ");
+    if (op == NULL || strcmp(op, "list") == 0) {
+        mtrace_list_range();
+    } else if (strcmp(op, "clear") == 0) {
+        mtrace_clear_range();
+    } else if (strcmp(op, "add") == 0) {
+        char *low = strtok(NULL, " ");
+        char *high = strtok(NULL, " ");
+        if (low == NULL || high == NULL ||
+            !mtrace_add_range(strtoull(low, NULL, 0), strtoull(high, NULL, 0))) {
+            printf("Usage: mtrace add LOW HIGH (at most 8 ranges)\n");
+        }
+    } else {
+        Log("命令mtrace的参数错误");
+    }
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_DIFFTEST
+static int cmd_detach(char *args) {
+    difftest_detach();
+    printf("Differential testing is detached\n");
+    return 0;
+}
+
+static int cmd_attach(char *args) {
+    char *arg = strtok(NULL, " ");
+    if (arg == NULL) difftest_attach();
+    else difftest_start_at(strtoull(arg, NULL, 0));
+    return 0;
+}
+#endif
+
 static int cmd_help(char *args);
 
 static struct {
@@ -180,6 +228,9 @@ static struct {
     {"p", "表达式求值", cmd_p},
     {"w", "设置监视点", cmd_w},
     {"d", "删除监视点", cmd_d},
+    IFDEF(CONFIG_MTRACE, {"mtrace", "内存访问追踪的地址范围: mtrace add LOW HIGH | clear | list", cmd_mtrace},)
+    IFDEF(CONFIG_DIFFTEST, {"detach", "退出差分测试模式", cmd_detach},)
+    IFDEF(CONFIG_DIFFTEST, {"attach", "进入差分测试模式, 并将当前状态复制到REF; attach N: 执行到第N条指令时再进入", cmd_attach},)
 };
 
 #define NR_CMD ARRLEN (cmd_table)    // 指令数量
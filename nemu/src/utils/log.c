@@ -18,12 +18,98 @@
 extern uint64_t g_nr_guest_inst;
 FILE *log_fp = NULL;
 
+#ifdef CONFIG_LOG_ASYNC
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/* The emulator formats log messages into the ring buffer, and a writer
+ * thread drains it to the log file with large fwrite() calls. Both ends
+ * only advance their own counter, so no lock is needed.
+ */
+#define LOG_BUF_SIZE CONFIG_LOG_ASYNC_BUF_SIZE
+static char log_buf[LOG_BUF_SIZE];
+static uint64_t log_head = 0; // advanced by the emulator
+static uint64_t log_tail = 0; // advanced by the writer thread
+static bool log_async = false;
+
+static void* log_writer(void *arg) {
+  while (true) {
+    uint64_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = log_tail;
+    if (head == tail) { usleep(1000); continue; }
+    uint64_t offset = tail % LOG_BUF_SIZE;
+    uint64_t n = head - tail;
+    if (n > LOG_BUF_SIZE - offset) n = LOG_BUF_SIZE - offset;
+    fwrite(log_buf + offset, 1, n, log_fp);
+    if (tail + n == head) fflush(log_fp);
+    __atomic_store_n(&log_tail, tail + n, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+void log_async_write(const char *fmt, ...) {
+  char buf[4096];
+  va_list ap, ap2;
+  va_start(ap, fmt);
+  va_copy(ap2, ap);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  char *p = buf;
+  if (len >= (int)sizeof(buf)) {
+    p = malloc(len + 1);
+    assert(p != NULL);
+    vsnprintf(p, len + 1, fmt, ap2);
+  }
+  va_end(ap2);
+  if (len < 0) return;
+
+  if (!log_async || len > LOG_BUF_SIZE) {
+    // a message larger than the buffer is written after the buffer is drained
+    log_flush();
+    fwrite(p, 1, len, log_fp);
+    fflush(log_fp);
+  } else {
+    uint64_t head = log_head;
+    while (head + len - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) > LOG_BUF_SIZE) {
+      sched_yield(); // the buffer is full, wait for the writer thread
+    }
+    uint64_t offset = head % LOG_BUF_SIZE;
+    uint64_t n = (len < LOG_BUF_SIZE - offset ? len : LOG_BUF_SIZE - offset);
+    memcpy(log_buf + offset, p, n);
+    memcpy(log_buf, p + n, len - n);
+    __atomic_store_n(&log_head, head + len, __ATOMIC_RELEASE);
+  }
+  if (p != buf) free(p);
+}
+#endif
+
+void log_flush() {
+#ifdef CONFIG_LOG_ASYNC
+  if (log_async) {
+    while (__atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) != log_head) {
+      sched_yield();
+    }
+  }
+#endif
+  if (log_fp != NULL) fflush(log_fp);
+}
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
     FILE *fp = fopen(log_file, "w");
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
+#ifdef CONFIG_LOG_ASYNC
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, log_writer, NULL);
+    Assert(ret == 0, "Can not create the log writer thread");
+    pthread_detach(thread);
+    log_async = true;
+    atexit(log_flush);
+#endif
   }
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
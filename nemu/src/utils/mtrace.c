@@ -0,0 +1,124 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <mtrace-def.h>
+
+#ifdef CONFIG_MTRACE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define NR_RANGE 8
+
+static struct {
+  paddr_t low, high;
+} ranges[NR_RANGE];
+static int nr_range = 0;
+
+// bounding box of all ranges, checked inline by mtrace_access()
+paddr_t mtrace_low = 0;
+paddr_t mtrace_high = (paddr_t)-1;
+
+static MTraceHeader *header = NULL;
+static MTraceRecord *records = NULL;
+
+static void update_bound() {
+  int i;
+  if (nr_range == 0) {
+    mtrace_low = 0;
+    mtrace_high = (paddr_t)-1;
+    return;
+  }
+  mtrace_low = ranges[0].low;
+  mtrace_high = ranges[0].high;
+  for (i = 1; i < nr_range; i ++) {
+    if (ranges[i].low < mtrace_low) mtrace_low = ranges[i].low;
+    if (ranges[i].high > mtrace_high) mtrace_high = ranges[i].high;
+  }
+}
+
+bool mtrace_add_range(paddr_t low, paddr_t high) {
+  if (nr_range == NR_RANGE || low > high) return false;
+  ranges[nr_range].low = low;
+  ranges[nr_range].high = high;
+  nr_range ++;
+  update_bound();
+  return true;
+}
+
+void mtrace_clear_range() {
+  nr_range = 0;
+  update_bound();
+}
+
+void mtrace_list_range() {
+  int i;
+  if (nr_range == 0) {
+    printf("all addresses are traced\n");
+  }
+  for (i = 0; i < nr_range; i ++) {
+    printf("%d: [" FMT_PADDR ", " FMT_PADDR "]\n", i, ranges[i].low, ranges[i].high);
+  }
+  printf("%" PRIu64 " records in %s\n", header->count, CONFIG_MTRACE_FILE);
+}
+
+void mtrace_record(vaddr_t pc, paddr_t addr, int len, word_t data, bool is_write) {
+  int i;
+  if (nr_range > 1) {
+    for (i = 0; i < nr_range; i ++) {
+      if (addr >= ranges[i].low && addr <= ranges[i].high) break;
+    }
+    if (i == nr_range) return;
+  }
+  if (len < 8) data &= BITMASK(len * 8);
+  uint64_t count = header->count;
+  records[count % CONFIG_MTRACE_NR_RECORD] = (MTraceRecord) {
+    .pc = pc, .addr = addr, .data = data, .len = len,
+    .type = (is_write ? MTRACE_WRITE : MTRACE_READ),
+  };
+  header->count = count + 1;
+}
+
+// "low-high,low-high,..."
+static void init_range(const char *str) {
+  char *p = (char *)str;
+  while (*p != '\0') {
+    paddr_t low = strtoull(p, &p, 0);
+    Assert(*p == '-', "Bad MTRACE_RANGE \"%s\"", str);
+    paddr_t high = strtoull(p + 1, &p, 0);
+    Assert(mtrace_add_range(low, high), "Bad MTRACE_RANGE \"%s\"", str);
+    if (*p == ',') p ++;
+  }
+}
+
+void init_mtrace() {
+  size_t size = sizeof(MTraceHeader) + sizeof(MTraceRecord) * CONFIG_MTRACE_NR_RECORD;
+  int fd = open(CONFIG_MTRACE_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(fd != -1, "Can not open '%s'", CONFIG_MTRACE_FILE);
+  int ret = ftruncate(fd, size);
+  Assert(ret == 0, "Can not resize '%s'", CONFIG_MTRACE_FILE);
+  header = (MTraceHeader *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(header != MAP_FAILED, "Can not mmap '%s'", CONFIG_MTRACE_FILE);
+  close(fd);
+  records = (MTraceRecord *)(header + 1);
+  *header = (MTraceHeader) { .magic = MTRACE_MAGIC, .record_size = sizeof(MTraceRecord),
+    .capacity = CONFIG_MTRACE_NR_RECORD, .count = 0 };
+
+  init_range(CONFIG_MTRACE_RANGE);
+  Log("Memory trace is written to %s", CONFIG_MTRACE_FILE);
+}
+
+#endif
@@ -43,3 +43,12 @@ uint64_t get_time() {
   uint64_t now = get_time_internal();
   return now - boot_time;
 }
+
+uint64_t get_guest_time() {
+#ifdef CONFIG_TIMER_ICOUNT
+  extern uint64_t g_nr_guest_inst;
+  return g_nr_guest_inst / CONFIG_TIMER_ICOUNT_MHZ;
+#else
+  return get_time();
+#endif
+}
@@ -20,8 +20,10 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <linux/kvm.h>
 
 /* CR0 bits */
@@ -35,6 +37,10 @@
 #define RFLAGS_AF  (1u << 4)
 #define RFLAGS_FIX_MASK (RFLAGS_ID | RFLAGS_AC | RFLAGS_RF | RFLAGS_TF | RFLAGS_AF)
 
+#define KVM_PAGE_SIZE 4096
+// give up running to the breakpoint after this, since the REF has diverged
+#define RUN_TIMEOUT_US 1000000
+
 struct vm {
   int sys_fd;
   int fd;
@@ -58,12 +64,11 @@ enum {
 
 static struct vm vm;
 static struct vcpu vcpu;
+static volatile bool run_timeout = false;
 
-// This should be called everytime after KVM_SET_REGS.
-// It seems that KVM_SET_REGS will clean the state of single step.
-static void kvm_set_step_mode(bool watch, uint32_t watch_addr) {
+static void kvm_set_debug(uint32_t control, bool watch, uint32_t watch_addr) {
   struct kvm_guest_debug debug = {};
-  debug.control = KVM_GUESTDBG_ENABLE | KVM_GUESTDBG_SINGLESTEP | KVM_GUESTDBG_USE_HW_BP;
+  debug.control = control;
   debug.arch.debugreg[0] = watch_addr;
   debug.arch.debugreg[7] = (watch ? 0x1 : 0x0); // watch instruction fetch at `watch_addr`
   if (ioctl(vcpu.fd, KVM_SET_GUEST_DEBUG, &debug) < 0) {
@@ -72,6 +77,13 @@ static void kvm_set_step_mode(bool watch, uint32_t watch_addr) {
   }
 }
 
+// This should be called everytime after KVM_SET_REGS.
+// It seems that KVM_SET_REGS will clean the state of single step.
+static void kvm_set_step_mode(bool watch, uint32_t watch_addr) {
+  kvm_set_debug(KVM_GUESTDBG_ENABLE | KVM_GUESTDBG_SINGLESTEP | KVM_GUESTDBG_USE_HW_BP,
+      watch, watch_addr);
+}
+
 static void kvm_setregs(const struct kvm_regs *r) {
   if (ioctl(vcpu.fd, KVM_SET_REGS, r) < 0) {
     perror("KVM_SET_REGS");
@@ -94,7 +106,7 @@ static void kvm_setsregs(const struct kvm_sregs *r) {
   }
 }
 
-static void* create_mem(int slot, uintptr_t base, size_t mem_size) {
+static void* create_mem(int slot, uintptr_t base, size_t mem_size, uint32_t flags) {
   void *mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
   if (mem == MAP_FAILED) {
@@ -106,7 +118,7 @@ static void* create_mem(int slot, uintptr_t base, size_t mem_size) {
 
   struct kvm_userspace_memory_region memreg;
   memreg.slot = slot;
-  memreg.flags = 0;
+  memreg.flags = flags;
   memreg.guest_phys_addr = base;
   memreg.memory_size = mem_size;
   memreg.userspace_addr = (unsigned long)mem;
@@ -149,8 +161,9 @@ static void vm_init(size_t mem_size) {
     assert(0);
   }
 
-  vm.mem = create_mem(0, 0, mem_size);
-  vm.mmio = create_mem(1, 0xa1000000, 0x1000);
+  // log the pages written by the guest for difftest_dirty_pages()
+  vm.mem = create_mem(0, 0, mem_size, KVM_MEM_LOG_DIRTY_PAGES);
+  vm.mmio = create_mem(1, 0xa1000000, 0x1000, 0);
 }
 
 static void vcpu_init() {
@@ -292,6 +305,11 @@ static void kvm_exec(uint64_t n) {
     uint64_t pc = vcpu.kvm_run->s.regs.regs.rip;
     if (ioctl(vcpu.fd, KVM_RUN, 0) < 0) {
       if (errno == EINTR) {
+        // stopped by the timeout of difftest_exec_until(), see run_timeout_handler()
+        if (run_timeout) {
+          vcpu.kvm_run->immediate_exit = 0;
+          return;
+        }
         n ++;
         continue;
       }
@@ -350,6 +368,10 @@ void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   else memcpy(buf, vm.mem + addr, n);
 }
 
+uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  return difftest_hash(DIFFTEST_HASH_INIT, vm.mem + addr, n);
+}
+
 void difftest_regcpy(void *r, bool direction) {
   struct kvm_regs *ref = &(vcpu.kvm_run->s.regs.regs);
   x86_CPU_state *x86 = r;
@@ -382,6 +404,86 @@ void difftest_exec(uint64_t n) {
   kvm_exec(n);
 }
 
+static void run_timeout_handler(int sig) {
+  run_timeout = true;
+  vcpu.kvm_run->immediate_exit = 1;
+}
+
+static void kvm_set_run_mode(bool run, uint32_t bp_addr) {
+  struct kvm_regs *r = &vcpu.kvm_run->s.regs.regs;
+  // TF is set for single-stepping, see difftest_regcpy()
+  if (run) r->rflags &= ~RFLAGS_TF;
+  else r->rflags |= RFLAGS_TF;
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+  if (run) kvm_set_debug(KVM_GUESTDBG_ENABLE | KVM_GUESTDBG_USE_HW_BP, true, bp_addr);
+  else kvm_set_step_mode(false, 0);
+}
+
+// Run without single-stepping until the instruction at `pc' is reached
+// `nr_hit' times, by setting a hardware breakpoint at it. KVM can not count
+// the instructions, so the bound `n' is not checked. The breakpoint
+// is left by single-stepping, since RF is not always honored by KVM. Note
+// that the patching for pushf, popf and pushing segment registers is not
+// done while running freely.
+void difftest_exec_until(uint64_t n, uint64_t pc, uint64_t nr_hit) {
+  struct kvm_regs *r = &vcpu.kvm_run->s.regs.regs;
+  struct itimerval it = { .it_value = { .tv_sec = RUN_TIMEOUT_US / 1000000,
+    .tv_usec = RUN_TIMEOUT_US % 1000000 } };
+  // the handler is only installed during the call, not to disturb other users of SIGALRM
+  struct sigaction sa = { .sa_handler = run_timeout_handler }, old_sa;
+  sigaction(SIGALRM, &sa, &old_sa);
+  run_timeout = false;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  bool run = false;
+  while (nr_hit > 0 && !run_timeout) {
+    // an interrupt being watched is also handled by single-stepping
+    if (r->rip == pc || vcpu.int_wp_state != STATE_IDLE) {
+      if (run) kvm_set_run_mode(run = false, 0);
+      kvm_exec(1);
+      if (r->rip == pc) nr_hit --;
+      continue;
+    }
+
+    if (!run) kvm_set_run_mode(run = true, pc);
+    if (ioctl(vcpu.fd, KVM_RUN, 0) < 0) {
+      if (errno == EINTR) continue;
+      perror("KVM_RUN");
+      assert(0);
+    }
+    if (vcpu.kvm_run->exit_reason == KVM_EXIT_DEBUG && r->rip == pc) nr_hit --;
+    // otherwise the REF has gone somewhere else, which is found by the DUT
+    else break;
+  }
+  if (run) kvm_set_run_mode(false, 0);
+
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_REAL, &it, NULL);
+  sigaction(SIGALRM, &old_sa, NULL);
+  vcpu.kvm_run->immediate_exit = 0;
+  run_timeout = false;
+}
+
+// report the pages written by the guest since the last call
+size_t difftest_dirty_pages(paddr_t *page, size_t max) {
+  static uint64_t bitmap[CONFIG_MSIZE / KVM_PAGE_SIZE / 64];
+  struct kvm_dirty_log log = { .slot = 0, .dirty_bitmap = bitmap };
+  if (ioctl(vm.fd, KVM_GET_DIRTY_LOG, &log) < 0) {
+    perror("KVM_GET_DIRTY_LOG");
+    assert(0);
+  }
+
+  size_t n = 0;
+  int i;
+  for (i = 0; i < ARRLEN(bitmap); i ++) {
+    uint64_t w = bitmap[i];
+    for (; w != 0 && n < max; w &= w - 1) {
+      page[n ++] = (i * 64 + __builtin_ctzll(w)) * KVM_PAGE_SIZE;
+    }
+  }
+  return n;
+}
+
 void difftest_raise_intr(word_t NO) {
   uint32_t pgate_vaddr = vcpu.kvm_run->s.regs.sregs.idt.base + NO * 8;
   uint32_t pgate = va2pa(pgate_vaddr);
@@ -0,0 +1,58 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mtrace-def.h>
+
+// usage: mtrace-decode [trace file]
+int main(int argc, char *argv[]) {
+  const char *file = (argc > 1 ? argv[1] : "/tmp/nemu-mtrace.bin");
+  int fd = open(file, O_RDONLY);
+  if (fd == -1) { perror(file); return 1; }
+  struct stat st;
+  fstat(fd, &st);
+  if (st.st_size < sizeof(MTraceHeader)) {
+    fprintf(stderr, "%s is too small\n", file);
+    return 1;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) { perror("mmap"); return 1; }
+  close(fd);
+
+  MTraceHeader *header = base;
+  if (header->magic != MTRACE_MAGIC || header->record_size != sizeof(MTraceRecord) ||
+      sizeof(MTraceHeader) + header->capacity * sizeof(MTraceRecord) > st.st_size) {
+    fprintf(stderr, "%s is not a valid mtrace file\n", file);
+    return 1;
+  }
+
+  MTraceRecord *records = (MTraceRecord *)(header + 1);
+  uint64_t count = header->count;
+  uint64_t i = (count > header->capacity ? count - header->capacity : 0);
+  if (i > 0) printf("# the oldest %" PRIu64 " records are overwritten\n", i);
+  for (; i < count; i ++) {
+    MTraceRecord *r = &records[i % header->capacity];
+    printf("%10" PRIu64 ": pc = 0x%08" PRIx64 " %c addr = 0x%08" PRIx64 " len = %" PRIu32
+        " data = 0x%0*" PRIx64 "\n", i, r->pc, (r->type == MTRACE_WRITE ? 'W' : 'R'),
+        r->addr, r->len, (int)r->len * 2, r->data);
+  }
+  return 0;
+}
@@ -20,19 +20,31 @@
 
 bool gdb_connect_qemu(int);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_memcpy_from_qemu(void *, uint32_t, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
 bool gdb_si();
+bool gdb_run_until(uint64_t, uint64_t);
 void gdb_exit();
 
 void init_isa();
 
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(direction == DIFFTEST_TO_REF);
-  if (direction == DIFFTEST_TO_REF) {
-    bool ok = gdb_memcpy_to_qemu(addr, buf, n);
-    assert(ok == 1);
-  }
+  bool ok;
+  if (direction == DIFFTEST_TO_REF) ok = gdb_memcpy_to_qemu(addr, buf, n);
+  else ok = gdb_memcpy_from_qemu(buf, addr, n);
+  assert(ok == 1);
+}
+
+// QEMU can not hash its memory, so the memory is read back and hashed here
+uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  uint8_t *buf = malloc(n);
+  assert(buf != NULL);
+  bool ok = gdb_memcpy_from_qemu(buf, addr, n);
+  assert(ok == 1);
+  uint64_t h = difftest_hash(DIFFTEST_HASH_INIT, buf, n);
+  free(buf);
+  return h;
 }
 
 void difftest_regcpy(void *dut, bool direction) {
@@ -50,6 +62,11 @@ void difftest_exec(uint64_t n) {
   while (n --) gdb_si();
 }
 
+// the bound `n' is not checked, since QEMU can not count the instructions
+void difftest_exec_until(uint64_t n, uint64_t pc, uint64_t nr_hit) {
+  if (!gdb_run_until(pc, nr_hit)) difftest_exec(n);
+}
+
 void difftest_init(int port) {
   char buf[32];
   sprintf(buf, "tcp::%d", port);
@@ -12,30 +12,85 @@
 *
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
-
 #include "common.h"
+#include <inttypes.h>
 
 static struct gdb_conn *conn;
 
+// the largest packet accepted by QEMU, updated from qSupported
+static int packet_size = 1500;
+// whether QEMU accepts memory writes in binary with `X'
+static bool binary_write = false;
+
+// the registers do not change until QEMU runs or they are written
+static union isa_gdb_regs regs_cache;
+static bool regs_valid = false;
+
+static bool gdb_request(const char *cmd, const char *expect) {
+  gdb_send(conn, (const uint8_t *)cmd, strlen(cmd));
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, expect);
+  free(reply);
+  return ok;
+}
+
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
     usleep(1);
   }
 
+  // the acks are useless on a reliable connection
+  gdb_start_noack(conn);
+
+  const char cmd[] = "qSupported";
+  gdb_send(conn, (const uint8_t *)cmd, strlen(cmd));
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  char *p = strstr((char *)reply, "PacketSize=");
+  if (p != NULL) packet_size = strtol(p + 11, NULL, 16);
+  free(reply);
+
+  // writing zero bytes is the standard way to probe `X'
+  binary_write = gdb_request("X0,0:", "OK");
+
   return true;
 }
 
-static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
-  char *buf = malloc(len * 2 + 128);
+// the header of a memory packet, the address and the length
+#define HDR_LEN 32
+
+// return the number of bytes written
+static int gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
+  char *buf = malloc(packet_size + HDR_LEN);
   assert(buf != NULL);
-  int p = sprintf(buf, "M0x%x,%x:", dest, len);
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+  uint8_t *s = src;
+  int n, p;
+  if (binary_write) {
+    // the length is unknown before escaping, so leave room for it
+    p = HDR_LEN;
+    for (n = 0; n < len && p < packet_size - 2; n ++) {
+      uint8_t c = s[n];
+      if (c == '$' || c == '#' || c == '}' || c == '*') {
+        buf[p ++] = '}';
+        c ^= 0x20;
+      }
+      buf[p ++] = c;
+    }
+    int h = sprintf(buf, "X0x%x,%x:", dest, n);
+    memmove(buf + HDR_LEN - h, buf, h);
+    gdb_send(conn, (const uint8_t *)buf + HDR_LEN - h, p - HDR_LEN + h);
+  } else {
+    n = (len < (packet_size - HDR_LEN) / 2 ? len : (packet_size - HDR_LEN) / 2);
+    p = sprintf(buf, "M0x%x,%x:", dest, n);
+    int i;
+    for (i = 0; i < n; i ++) {
+      buf[p ++] = hex_encode(s[i] >> 4);
+      buf[p ++] = hex_encode(s[i] & 0xf);
+    }
+    gdb_send(conn, (const uint8_t *)buf, p);
   }
-
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
   free(buf);
 
   size_t size;
@@ -43,23 +98,57 @@ static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
   bool ok = !strcmp((const char*)reply, "OK");
   free(reply);
 
-  return ok;
+  return ok ? n : -1;
 }
 
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+  while (len > 0) {
+    int n = gdb_memcpy_to_qemu_small(dest, src, len);
+    if (n < 0) return false;
+    dest += n;
+    src += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool gdb_memcpy_from_qemu_small(void *dest, uint32_t src, int len) {
+  char buf[64];
+  sprintf(buf, "m0x%x,%x", src, len);
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = (size == len * 2);
+  int i;
+  for (i = 0; ok && i < len; i ++) {
+    ((uint8_t *)dest)[i] = gdb_decode_hex(reply[i * 2], reply[i * 2 + 1]);
+  }
+  free(reply);
+
+  return ok;
+}
+
+bool gdb_memcpy_from_qemu(void *dest, uint32_t src, int len) {
+  // the reply is in hex
+  const int mtu = (packet_size - HDR_LEN) / 2;
   bool ok = true;
   while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
+    ok &= gdb_memcpy_from_qemu_small(dest, src, mtu);
     dest += mtu;
     src += mtu;
     len -= mtu;
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
+  ok &= gdb_memcpy_from_qemu_small(dest, src, len);
   return ok;
 }
 
 bool gdb_getregs(union isa_gdb_regs *r) {
+  if (regs_valid) {
+    *r = regs_cache;
+    return true;
+  }
+
   gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
@@ -77,6 +166,8 @@ bool gdb_getregs(union isa_gdb_regs *r) {
 
   free(reply);
 
+  regs_cache = *r;
+  regs_valid = true;
   return true;
 }
 
@@ -86,14 +177,15 @@ bool gdb_setregs(union isa_gdb_regs *r) {
   assert(buf != NULL);
   buf[0] = 'G';
 
-  void *src = r;
+  uint8_t *src = (uint8_t *)r;
   int p = 1;
   int i;
   for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+    buf[p ++] = hex_encode(src[i] >> 4);
+    buf[p ++] = hex_encode(src[i] & 0xf);
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, (const uint8_t *)buf, p);
   free(buf);
 
   size_t size;
@@ -101,11 +193,16 @@ bool gdb_setregs(union isa_gdb_regs *r) {
   bool ok = !strcmp((const char*)reply, "OK");
   free(reply);
 
+  regs_cache = *r;
+  regs_valid = ok;
   return ok;
 }
 
+// QEMU stops the guest when any byte arrives while it is running,
+// so the steps can not be sent ahead of their replies
 bool gdb_si() {
   char buf[] = "vCont;s:1";
+  regs_valid = false;
   gdb_send(conn, (const uint8_t *)buf, strlen(buf));
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
@@ -113,6 +210,54 @@ bool gdb_si() {
   return true;
 }
 
+// the REF is considered to have gone astray if it runs longer than this
+#define RUN_TIMEOUT_MS 1000
+
+// return false if the breakpoint is not reached in time
+static bool gdb_continue() {
+  char buf[] = "vCont;c:1";
+  regs_valid = false;
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  bool ok = gdb_wait(conn, RUN_TIMEOUT_MS);
+  if (!ok) gdb_interrupt(conn);
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  free(reply);
+  return ok;
+}
+
+// Run until the instruction at `pc' is reached `nr_hit' times, with a
+// software breakpoint at it. QEMU stops at the breakpoint again when it
+// continues from there, so the breakpoint is left by single-stepping.
+// Return false if QEMU does not accept the breakpoint.
+bool gdb_run_until(uint64_t pc, uint64_t nr_hit) {
+  char bp[64];
+  // QEMU ignores the kind of software breakpoints
+  sprintf(bp, "Z0,%" PRIx64 ",4", pc);
+  if (!gdb_request(bp, "OK")) return false;
+
+  union isa_gdb_regs r;
+  gdb_getregs(&r);
+  bool at_bp = (ISA_GDB_PC(r) == pc);
+  while (nr_hit > 0) {
+    if (at_bp) {
+      gdb_si();
+      gdb_getregs(&r);
+      at_bp = (ISA_GDB_PC(r) == pc);
+      if (at_bp) nr_hit --;
+      continue;
+    }
+    // a timeout means the REF has gone somewhere else, which is found by the DUT
+    if (!gdb_continue()) break;
+    at_bp = true;
+    nr_hit --;
+  }
+
+  bp[0] = 'z';
+  gdb_request(bp, "OK");
+  return true;
+}
+
 void gdb_exit() {
   gdb_end(conn);
 }
@@ -20,21 +20,61 @@
 #include "common.h"
 #include <ctype.h>
 #include <err.h>
+#include <errno.h>
 
 #include <arpa/inet.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
+#include <poll.h>
+
 #include <sys/socket.h>
 #include <sys/types.h>
 
+// the socket is read through a buffer of our own instead of stdio,
+// since replies are parsed character by character
+#define RBUF_SIZE 65536
+
 struct gdb_conn {
-  FILE *in;
-  FILE *out;
+  int fd;
   bool ack;
+  size_t rpos, rlen;
+  uint8_t rbuf[RBUF_SIZE];
 };
 
+static int conn_getc(struct gdb_conn *conn) {
+  if (conn->rpos == conn->rlen) {
+    ssize_t n;
+    do {
+      n = read(conn->fd, conn->rbuf, RBUF_SIZE);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+      err(1, "recv");
+    else if (n == 0)
+      errx(0, "recv: Connection closed");
+    conn->rpos = 0;
+    conn->rlen = n;
+  }
+  return conn->rbuf[conn->rpos++];
+}
+
+static void conn_ungetc(struct gdb_conn *conn) {
+  conn->rpos--;
+}
+
+static void conn_write(struct gdb_conn *conn, const void *buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(conn->fd, buf, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      err(1, "send");
+    buf += n;
+    size -= n;
+  }
+}
+
 
 static uint8_t
 hex_nibble(uint8_t hex) {
@@ -69,25 +109,10 @@ static struct gdb_conn* gdb_begin(int fd) {
     err(1, "calloc");
 
   conn->ack = true;
-
-  // duplicate the handle to separate read/write state
-  int fd2 = dup(fd);
-  if (fd2 < 0)
-    err(1, "dup");
-
-  // open a FILE* for reading
-  conn->in = fdopen(fd, "rb");
-  if (conn->in == NULL)
-    err(1, "fdopen");
-
-  // open a FILE* for writing
-  conn->out = fdopen(fd2, "wb");
-  if (conn->out == NULL)
-    err(1, "fdopen");
+  conn->fd = fd;
 
   // reset line state by acking any earlier input
-  fputc('+', conn->out);
-  fflush(conn->out);
+  conn_write(conn, "+", 1);
 
   return conn;
 }
@@ -130,12 +155,11 @@ struct gdb_conn* gdb_begin_inet(const char *addr, uint16_t port) {
 
 
 void gdb_end(struct gdb_conn *conn) {
-  fclose(conn->in);
-  fclose(conn->out);
+  close(conn->fd);
   free(conn);
 }
 
-static void send_packet(FILE *out, const uint8_t *command, size_t size) {
+static void send_packet(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   // compute the checksum -- simple mod256 addition
   uint8_t sum = 0;
   size_t i;
@@ -146,31 +170,33 @@ static void send_packet(FILE *out, const uint8_t *command, size_t size) {
   // gdbserver.  e.g. giving "invalid hex digit" on an RLE'd address.
   // So just write raw here, and maybe let higher levels escape/RLE.
 
-  fputc('$', out); // packet start
-  fwrite(command, 1, size, out); // payload
-  fprintf(out, "#%02X", sum); // packet end, checksum
-  fflush(out);
-
-  if (ferror(out))
-    err(1, "send");
-  else if (feof(out))
-    errx(0, "send: Connection closed");
+  // assemble the whole packet to send it with a single write
+  uint8_t *buf = malloc(size + 4);
+  if (buf == NULL)
+    err(1, "malloc");
+  buf[0] = '$'; // packet start
+  memcpy(buf + 1, command, size); // payload
+  buf[size + 1] = '#'; // packet end, checksum
+  buf[size + 2] = hex_encode(sum >> 4);
+  buf[size + 3] = hex_encode(sum & 0xf);
+  conn_write(conn, buf, size + 4);
+  free(buf);
 }
 
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   bool acked = false;
   do {
-    send_packet(conn->out, command, size);
+    send_packet(conn, command, size);
 
     if (!conn->ack)
       break;
 
     // look for '+' ACK or '-' NACK/resend
-    acked = fgetc(conn->in) == '+';
+    acked = conn_getc(conn) == '+';
   } while (!acked);
 }
 
-static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
+static uint8_t* recv_packet(struct gdb_conn *conn, size_t *ret_size, bool* ret_sum_ok) {
   size_t i = 0;
   size_t size = 4096;
   uint8_t *reply = malloc(size);
@@ -182,9 +208,10 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
   bool escape = false;
 
   // fast-forward to the first start of packet
-  while ((c = fgetc(in)) != EOF && c != '$');
+  while ((c = conn_getc(conn)) != '$');
 
-  while ((c = fgetc(in)) != EOF) {
+  while (true) {
+    c = conn_getc(conn);
     sum += c;
     switch (c) {
       case '$': // new packet?  start over...
@@ -196,8 +223,8 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
       case '#': // end of packet
         sum -= c; // not part of the checksum
         {
-          uint8_t msb = fgetc(in);
-          uint8_t lsb = fgetc(in);
+          uint8_t msb = conn_getc(conn);
+          uint8_t lsb = conn_getc(conn);
           *ret_sum_ok = sum == gdb_decode_hex(msb, lsb);
         }
         *ret_size = i;
@@ -223,10 +250,10 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
         // The count character can't be >126 or '$'/'#' packet markers.
 
         if (i > 0) { // need something to repeat!
-          int c2 = fgetc(in);
+          int c2 = conn_getc(conn);
           if (c2 < 29 || c2 > 126 || c2 == '$' || c2 == '#') {
             // invalid count character!
-            ungetc(c2, in);
+            conn_ungetc(conn);
           } else {
             int count = c2 - 29;
 
@@ -264,27 +291,31 @@ static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
     // add one character
     reply[i++] = c;
   }
+}
+
+// wait at most `timeout_ms' for a reply, return whether one has arrived
+bool gdb_wait(struct gdb_conn *conn, int timeout_ms) {
+  if (conn->rpos < conn->rlen) return true;
+  struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
 
-  if (ferror(in))
-    err(1, "recv");
-  else if (feof(in))
-    errx(0, "recv: Connection closed");
-  else
-    errx(1, "recv: Unknown connection error");
+// stop the running target, which then sends a stop reply
+void gdb_interrupt(struct gdb_conn *conn) {
+  conn_write(conn, "\x03", 1);
 }
 
 uint8_t* gdb_recv(struct gdb_conn *conn, size_t *size) {
   uint8_t *reply;
   bool acked = false;
   do {
-    reply = recv_packet(conn->in, size, &acked);
+    reply = recv_packet(conn, size, &acked);
 
     if (!conn->ack)
       break;
 
     // send +/- depending on checksum result, retry if needed
-    fputc(acked ? '+' : '-', conn->out);
-    fflush(conn->out);
+    conn_write(conn, acked ? "+" : "-", 1);
   } while (!acked);
 
   return reply;
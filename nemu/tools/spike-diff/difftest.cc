@@ -16,6 +16,7 @@
 #include "sim.h"
 #include "../../include/common.h"
 #include <difftest-def.h>
+#include <deque>
 
 #ifdef CONFIG_ISA_riscv32
 #undef DEFAULT_ISA
@@ -38,6 +39,42 @@ static debug_module_config_t difftest_dm_config = {
   .support_impebreak = true
 };
 
+// the device space of NEMU, the accesses to it are replayed from the DUT
+#define DIFFTEST_MMIO_BASE 0xa0000000
+
+class difftest_mmio_t : public abstract_device_t {
+ public:
+  std::deque<DifftestMMIO> queue;
+  bool ok = true;
+
+  bool load(reg_t addr, size_t len, uint8_t* bytes) {
+    uint64_t data = 0;
+    if (match(addr, len, false)) data = queue.front().data;
+    else ok = false;
+    if (!queue.empty()) queue.pop_front();
+    memcpy(bytes, &data, len);
+    return true;
+  }
+
+  bool store(reg_t addr, size_t len, const uint8_t* bytes) {
+    uint64_t data = 0;
+    memcpy(&data, bytes, len);
+    uint64_t mask = (len < 8 ? (1ull << (len * 8)) - 1 : -1ull);
+    if (!match(addr, len, true) || (queue.front().data & mask) != data) ok = false;
+    if (!queue.empty()) queue.pop_front();
+    return true;
+  }
+
+ private:
+  bool match(reg_t addr, size_t len, bool is_write) {
+    if (queue.empty()) return false;
+    DifftestMMIO &ev = queue.front();
+    return ev.addr == DIFFTEST_MMIO_BASE + addr && ev.len == len && ev.is_write == is_write;
+  }
+};
+
+static difftest_mmio_t difftest_mmio_dev;
+
 struct diff_context_t {
   word_t gpr[32];
   word_t pc;
@@ -82,11 +119,47 @@ void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
 extern "C" {
 
 void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
+  mem_t *mem = difftest_mem[0].second;
+  if (addr >= DRAM_BASE && addr - DRAM_BASE + n <= mem->size()) {
+    // copy page by page, e.g. the whole memory when attaching
+    uint8_t *b = (uint8_t *)buf;
+    while (n > 0) {
+      reg_t off = addr - DRAM_BASE;
+      size_t len = PGSIZE - (off % PGSIZE);
+      if (len > n) len = n;
+      if (direction == DIFFTEST_TO_REF) memcpy(mem->contents(off), b, len);
+      else memcpy(b, mem->contents(off), len);
+      addr += len;
+      b += len;
+      n -= len;
+    }
+    // the instructions decoded from the old content are stale
+    if (direction == DIFFTEST_TO_REF) p->get_mmu()->flush_icache();
+    return;
+  }
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    mmu_t* mmu = p->get_mmu();
+    for (size_t i = 0; i < n; i++) {
+      *((uint8_t*)buf+i) = mmu->load_uint8(addr+i);
+    }
+  }
+}
+
+// the memory of spike is allocated by pages, so hash it page by page
+uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  mem_t *mem = difftest_mem[0].second;
+  uint64_t h = DIFFTEST_HASH_INIT;
+  while (n > 0) {
+    reg_t off = addr - DRAM_BASE;
+    size_t len = PGSIZE - (off % PGSIZE);
+    if (len > n) len = n;
+    h = difftest_hash(h, mem->contents(off), len);
+    addr += len;
+    n -= len;
   }
+  return h;
 }
 
 void difftest_regcpy(void* dut, bool direction) {
@@ -101,12 +174,70 @@ void difftest_exec(uint64_t n) {
   s->diff_step(n);
 }
 
+// spike counts the instructions exactly, so stepping `n' instructions at
+// once already stops at the right place
+void difftest_exec_until(uint64_t n, uint64_t pc, uint64_t nr_hit) {
+  s->diff_step(n);
+}
+
+static const int difftest_csr_addr[] = {
+#define CSR_ADDR(name, addr) addr,
+  DIFFTEST_CSR_LIST(CSR_ADDR)
+};
+
+void difftest_csrcpy(void *dut, bool direction) {
+  word_t *csr = (word_t *)dut;
+  for (int i = 0; i < NR_DIFFTEST_CSR; i++) {
+    if (direction == DIFFTEST_TO_REF) {
+      // writing misa may turn off extensions of spike
+      if (i != DIFFTEST_CSR_misa) p->put_csr(difftest_csr_addr[i], csr[i]);
+    } else {
+      csr[i] = p->get_csr(difftest_csr_addr[i]);
+    }
+  }
+}
+
+// Return whether the device accesses since the last call are exactly the
+// ones passed in, then queue `ev' for the following instructions.
+bool difftest_mmio(DifftestMMIO *ev, int n) {
+  bool ok = difftest_mmio_dev.ok && difftest_mmio_dev.queue.empty();
+  difftest_mmio_dev.queue.assign(ev, ev + n);
+  difftest_mmio_dev.ok = true;
+  return ok;
+}
+
+// report the effect of the last instruction from the commit log of spike
+void difftest_commit(DifftestCommit *c) {
+  c->npc = state->pc;
+  c->wreg = 0;
+  c->wdata = 0;
+  for (auto &w : state->log_reg_write) {
+    // the low 4 bits are the type of the register, 0 for GPRs
+    reg_t idx = w.first >> 4;
+    if ((w.first & 0xf) == 0 && idx != 0) {
+      c->wreg = idx;
+      c->wdata = w.second.v[0];
+    }
+  }
+  c->mlen = 0;
+  if (!state->log_mem_write.empty()) {
+    auto &m = state->log_mem_write.back();
+    c->maddr = std::get<0>(m);
+    c->mdata = std::get<1>(m);
+    c->mlen = std::get<2>(m);
+  }
+}
+
 void difftest_init(int port) {
   difftest_htif_args.push_back("");
+  difftest_plugin_devices.push_back(std::make_pair(reg_t(DIFFTEST_MMIO_BASE), &difftest_mmio_dev));
+  // the commit log is only used by difftest_commit(), do not print it
+  const char *log_path = MUXDEF(CONFIG_DIFFTEST_COMMIT, "/dev/null", nullptr);
   s = new sim_t(DEFAULT_ISA, DEFAULT_PRIV, DEFAULT_VARCH, 1, false, false,
       0, 0, NULL, reg_t(-1), difftest_mem, difftest_plugin_devices, difftest_htif_args,
-      std::move(difftest_hartids), difftest_dm_config, nullptr, false, NULL, true);
+      std::move(difftest_hartids), difftest_dm_config, log_path, false, NULL, true);
   s->diff_init(port);
+  IFDEF(CONFIG_DIFFTEST_COMMIT, p->enable_log_commits());
 }
 
 void difftest_raise_intr(uint64_t NO) {